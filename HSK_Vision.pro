@@ -7,15 +7,18 @@
 TEMPLATE = app
 TARGET = HSK_Vision
 
-QT += core gui multimedia multimediawidgets concurrent
+QT += core gui multimedia multimediawidgets concurrent network
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 INCLUDEPATH += .
+CONFIG += c++17
 
 # use your own path in the following config
 unix: {
     INCLUDEPATH += /usr/include/tesseract
     LIBS += -L/usr/lib/x86_64-linux-gnu -ltesseract
+    # shm_open
+    LIBS += -lrt
 }
 
 # opencv config
@@ -34,15 +37,53 @@ DEFINES += TESSDATA_PREFIX=\\\"/usr/share/tesseract-ocr/4.00/tessdata/\\\"
 
 # Input
 HEADERS += mainwindow.h screencapturer.h \
+    batch_ocr.h \
+    capture_engine.h \
+    capture_pipeline.h \
+    change_detector.h \
+    event_dispatcher.h \
+    frame_ring.h \
+    frame_source.h \
+    motion_detector.h \
     necta_camera.h \
     oakd_camera.h \
+    pipeline_metrics.h \
+    recording.h \
+    roiselector.h \
+    shm_frame_ring.h \
+    ocr_worker.h \
+    tesseract_pool.h \
+    text_detector.h \
     usb_camera.h \
-    utilities.h
+    utilities.h \
+    video_recorder.h \
+    video_widget.h
 SOURCES += main.cpp mainwindow.cpp screencapturer.cpp \
+    batch_ocr.cpp \
+    capture_engine.cpp \
+    capture_pipeline.cpp \
+    change_detector.cpp \
+    event_dispatcher.cpp \
+    frame_ring.cpp \
+    frame_source.cpp \
+    motion_detector.cpp \
     necta_camera.cpp \
     oakd_camera.cpp \
+    pipeline_metrics.cpp \
+    recording.cpp \
+    roiselector.cpp \
+    shm_frame_ring.cpp \
+    ocr_worker.cpp \
+    tesseract_pool.cpp \
+    text_detector.cpp \
     usb_camera.cpp \
-    utilities.cpp
+    utilities.cpp \
+    video_recorder.cpp \
+    video_widget.cpp
 
 FORMS += \
     mainwindow.ui
+
+# OAK-D frame producer, started next to the executable
+DISTFILES += oakd_stream.py
+QMAKE_POST_LINK += $$QMAKE_COPY $$shell_path($$PWD/oakd_stream.py) $$shell_path($$OUT_PWD)
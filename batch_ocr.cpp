@@ -0,0 +1,348 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <clocale>
+#include <cstdio>
+#include <cstring>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QThread>
+
+#include "tesseract/baseapi.h"
+
+#include "batch_ocr.h"
+#include "change_detector.h"
+#include "recording.h"
+#include "tesseract_pool.h"
+#include "text_detector.h"
+#include "utilities.h"
+
+// Takes images, then runs of recorded frames, from the shared lists until
+// they are exhausted. Each worker owns its network and Tesseract instance,
+// so workers never wait on each other.
+class BatchWorker : public QThread
+{
+public:
+    explicit BatchWorker(BatchOcr *batch): batch(batch) {}
+
+protected:
+    void run() override;
+
+private:
+    void processImage(const QString &path);
+    void processRun(const BatchOcr::FrameRun &run);
+    // image is BGR
+    void recognize(const cv::Mat &image, QJsonObject &result);
+    void report(const QJsonObject &result);
+
+private:
+    BatchOcr *batch;
+    tesseract::TessBaseAPI tesseractAPI;
+    TextDetector detector;
+};
+
+void BatchWorker::run() {
+    // Initialize tesseract-ocr with English, with specifying tessdata path
+    if (tesseractAPI.Init(TESSDATA_PREFIX, "eng")) {
+        qWarning("Tesseract could not be initialized.");
+        batch->failed_workers.fetchAndAddRelaxed(1);
+        return;
+    }
+    if(batch->options.detect_areas) {
+        detector.load();
+    }
+
+    for(;;) {
+        int index = batch->next_image.fetchAndAddOrdered(1);
+        if(index < batch->images.size()) {
+            processImage(batch->images.at(index));
+        } else if(index - batch->images.size() < batch->frame_runs.size()) {
+            processRun(batch->frame_runs.at(index - batch->images.size()));
+        } else {
+            break;
+        }
+    }
+    tesseractAPI.End();
+}
+
+void BatchWorker::processImage(const QString &path)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QJsonObject result;
+    result.insert("file", path);
+    cv::Mat image = cv::imread(path.toStdString(), cv::IMREAD_COLOR);
+    if(image.empty()) {
+        result.insert("error", "image could not be read");
+        batch->failed_images.fetchAndAddRelaxed(1);
+        batch->writeLine(QJsonDocument(result).toJson(QJsonDocument::Compact));
+        return;
+    }
+    recognize(image, result);
+    result.insert("ms", (double)timer.nsecsElapsed() / 1e6);
+    report(result);
+}
+
+void BatchWorker::processRun(const BatchOcr::FrameRun &run)
+{
+    const RecordingReader *recording = batch->recordings.at(run.recording);
+    ChangeDetector change_detector(batch->change_threshold);
+    cv::Mat frame, image;
+    for(int i = run.first; i < run.end; i += batch->options.step) {
+        QElapsedTimer timer;
+        timer.start();
+
+        const RecordingIndexEntry &entry = recording->entry(i);
+        QJsonObject result;
+        result.insert("recording", recording->name());
+        result.insert("frame", i);
+        result.insert("sequence", (qint64)entry.sequence);
+        result.insert("time", (entry.timestamp - recording->startTime()) / 1e6);
+        QDateTime captured = recording->wallClock(i);
+        if(captured.isValid()) {
+            result.insert("captured", captured.toString(Qt::ISODateWithMs));
+        }
+        if(!recording->readFrame(i, frame)) {
+            result.insert("error", "frame could not be decoded");
+            batch->failed_images.fetchAndAddRelaxed(1);
+            batch->writeLine(QJsonDocument(result).toJson(QJsonDocument::Compact));
+            continue;
+        }
+        batch->scanned_frames.fetchAndAddRelaxed(1);
+        if(!change_detector.update(frame)) {
+            batch->unchanged_frames.fetchAndAddRelaxed(1);
+            continue;
+        }
+        // EAST takes color, as the capture pipeline gives it
+        if(frame.channels() == 1) {
+            cv::cvtColor(frame, image, cv::COLOR_GRAY2BGR);
+            recognize(image, result);
+        } else {
+            recognize(frame, result);
+        }
+        result.insert("ms", (double)timer.nsecsElapsed() / 1e6);
+        report(result);
+    }
+}
+
+void BatchWorker::recognize(const cv::Mat &image, QJsonObject &result)
+{
+    std::vector<cv::Rect> regions;
+    if(batch->options.use_regions) {
+        regions = TextDetector::clipRegions(batch->regions_of_interest, image.size());
+    }
+    QString text;
+    std::vector<cv::Rect> areas;
+    if(batch->options.detect_areas) {
+        detector.detect(image, regions, areas);
+        text = TesseractPool::recognizeAreas(&tesseractAPI, image, areas);
+    } else if(!regions.empty()) {
+        areas = regions;
+        text = TesseractPool::recognizeAreas(&tesseractAPI, image, areas);
+    } else {
+        TesseractPool::setImage(&tesseractAPI, image, cv::Rect(0, 0, image.cols, image.rows));
+        char *outText = tesseractAPI.GetUTF8Text();
+        text = QString::fromUtf8(outText);
+        delete [] outText;
+    }
+
+    QJsonArray boxes;
+    for(const cv::Rect &area : areas) {
+        boxes.append(QJsonArray({area.x, area.y, area.width, area.height}));
+    }
+    result.insert("width", image.cols);
+    result.insert("height", image.rows);
+    result.insert("text", text);
+    result.insert("areas", boxes);
+}
+
+void BatchWorker::report(const QJsonObject &result)
+{
+    if(!batch->options.find.isEmpty()
+       && !result.value("text").toString().contains(batch->options.find, Qt::CaseInsensitive)) {
+        return;
+    }
+    batch->writeLine(QJsonDocument(result).toJson(QJsonDocument::Compact));
+}
+
+bool BatchOcr::requested(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--batch") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int BatchOcr::main(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs OCR on images without a GUI and prints JSON lines.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("batch", "Run in headless batch mode."));
+    parser.addOption(QCommandLineOption(QStringList() << "j" << "workers",
+        "Number of worker threads, one per core by default.", "count", "0"));
+    parser.addOption(QCommandLineOption("no-detect", "Recognize whole images, without EAST."));
+    parser.addOption(QCommandLineOption("roi", "Only look inside the saved regions of interest of the first camera."));
+    parser.addOption(QCommandLineOption("recordings",
+        "Inputs are recordings, or directories of recordings, instead of images."));
+    parser.addOption(QCommandLineOption("step", "Only scan one recorded frame out of count.", "count", "1"));
+    parser.addOption(QCommandLineOption("find", "Only print results whose text contains text.", "text"));
+    parser.addPositionalArgument("inputs", "Image files, recordings or directories.", "<dir|file>...");
+    parser.process(arguments);
+
+    Options options;
+    options.inputs = parser.positionalArguments();
+    options.workers = parser.value("workers").toInt();
+    options.detect_areas = !parser.isSet("no-detect");
+    options.use_regions = parser.isSet("roi");
+    options.recordings = parser.isSet("recordings");
+    options.step = qMax(1, parser.value("step").toInt());
+    options.find = parser.value("find");
+    if(options.inputs.isEmpty()) {
+        parser.showHelp(1);
+    }
+    BatchOcr batch(options);
+    return batch.run();
+}
+
+BatchOcr::BatchOcr(const Options &options):
+    options(options), next_image(0), failed_workers(0), failed_images(0), scanned_frames(0),
+    unchanged_frames(0)
+{
+    change_threshold = QSettings().value("ocr/change_threshold", 8.0).toDouble();
+    if(this->options.workers <= 0) {
+        this->options.workers = QThread::idealThreadCount();
+    }
+    if(this->options.use_regions) {
+        regions_of_interest = Utilities::loadRegionsOfInterest();
+    }
+}
+
+BatchOcr::~BatchOcr()
+{
+    qDeleteAll(recordings);
+}
+
+int BatchOcr::run()
+{
+    // no GUI in this mode, so Tesseract can keep the C locale for good
+    setlocale(LC_ALL, "C");
+
+    QElapsedTimer timer;
+    timer.start();
+    if(options.recordings) {
+        collectRecordings();
+    } else {
+        images = collectImages();
+    }
+    int workers = processImages();
+    if(failed_workers.load() == workers) {
+        // nothing was recognized, e.g. tessdata is not where it was built for
+        fprintf(stderr, "No worker could initialize Tesseract from %s\n", TESSDATA_PREFIX);
+        return 2;
+    }
+
+    double seconds = timer.elapsed() / 1000.0;
+    if(options.recordings) {
+        int scanned = scanned_frames.load();
+        fprintf(stderr, "%d frames of %d recordings in %.1f s (%.1f frames/s) with %d workers, "
+                "%d unchanged, %d failed\n",
+                scanned, recordings.size(), seconds, seconds > 0 ? scanned / seconds : 0.0,
+                options.workers, (int)unchanged_frames.load(), (int)failed_images.load());
+    } else {
+        fprintf(stderr, "%d images in %.1f s (%.1f images/s) with %d workers, %d failed\n",
+                images.size(), seconds, seconds > 0 ? images.size() / seconds : 0.0,
+                options.workers, (int)failed_images.load());
+    }
+    return failed_images.load() == 0 ? 0 : 2;
+}
+
+QStringList BatchOcr::collectImages() const
+{
+    QStringList filters;
+    filters << "*.png" << "*.bmp" << "*.jpg" << "*.jpeg" << "*.tif" << "*.tiff";
+    QStringList found;
+    for(const QString &input : options.inputs) {
+        QFileInfo info(input);
+        if(info.isDir()) {
+            QDirIterator it(input, filters, QDir::Files, QDirIterator::Subdirectories);
+            QStringList files;
+            while(it.hasNext()) {
+                files << it.next();
+            }
+            files.sort();
+            found << files;
+        } else {
+            found << input;
+        }
+    }
+    return found;
+}
+
+void BatchOcr::collectRecordings()
+{
+    QStringList names;
+    for(const QString &input : options.inputs) {
+        if(QFileInfo(input).isDir()) {
+            names << RecordingReader::find(input);
+        } else {
+            names << input;
+        }
+    }
+    // runs short enough to share a recording between the workers, long
+    // enough for most frames to be compared with the previous one
+    const int run_length = 512 * options.step;
+    for(const QString &name : names) {
+        RecordingReader *recording = new RecordingReader();
+        if(!recording->open(name)) {
+            fprintf(stderr, "%s is not a recording\n", name.toLocal8Bit().constData());
+            failed_images.fetchAndAddRelaxed(1);
+            delete recording;
+            continue;
+        }
+        for(int first = 0; first < recording->frameCount(); first += run_length) {
+            frame_runs.append(FrameRun{recordings.size(), first,
+                                       qMin(first + run_length, recording->frameCount())});
+        }
+        recordings.append(recording);
+    }
+}
+
+int BatchOcr::processImages()
+{
+    QList<BatchWorker*> workers;
+    int count = qMin(options.workers, qMax(1, images.size() + frame_runs.size()));
+    for(int i = 0; i < count; i++) {
+        BatchWorker *worker = new BatchWorker(this);
+        workers.append(worker);
+        worker->start();
+    }
+    for(BatchWorker *worker : workers) {
+        worker->wait();
+        delete worker;
+    }
+    return count;
+}
+
+void BatchOcr::writeLine(const QByteArray &line)
+{
+    QMutexLocker locker(&output_lock);
+    fwrite(line.constData(), 1, line.size(), stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
@@ -0,0 +1,86 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BATCH_OCR_H
+#define BATCH_OCR_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QStringList>
+#include <QList>
+#include <QRect>
+#include <QVector>
+
+class RecordingReader;
+
+// Headless OCR over directories or lists of image files, for re-checking
+// archived inspection images without a display:
+//
+//   HSK_Vision --batch [--workers N] [--no-detect] [--roi] <dir|file>...
+//   HSK_Vision --batch --recordings [--step N] [--find TEXT] <dir|recording>...
+//
+// One worker per core runs the same EAST + Tesseract pipeline as the GUI on
+// its own images. Recordings are split in runs of consecutive frames; within
+// a run, frames that did not change since the last one recognized are not
+// recognized again, which is most of the footage of a static scene. Every
+// result is written to stdout as soon as it is ready, as one JSON object per
+// line.
+class BatchOcr
+{
+public:
+    struct Options {
+        QStringList inputs;
+        int workers;
+        bool detect_areas;
+        bool use_regions;
+        bool recordings;
+        int step;           // frames of recordings, 1 for all of them
+        QString find;       // only report results containing this text
+    };
+
+    // True when the command line asks for batch mode, checked before any
+    // QApplication is created.
+    static bool requested(int argc, char *argv[]);
+    // Parses the arguments of a running QCoreApplication and runs the batch.
+    static int main(const QStringList &arguments);
+
+    explicit BatchOcr(const Options &options);
+    ~BatchOcr();
+    int run();
+
+private:
+    // Consecutive frames of a recording, handled by one worker.
+    struct FrameRun {
+        int recording;
+        int first;
+        int end;
+    };
+
+    QStringList collectImages() const;
+    void collectRecordings();
+    // Returns the number of workers run.
+    int processImages();
+    void writeLine(const QByteArray &line);
+
+private:
+    friend class BatchWorker;
+
+    Options options;
+    QStringList images;
+    QList<RecordingReader*> recordings;
+    QVector<FrameRun> frame_runs;
+    QList<QRect> regions_of_interest;
+    double change_threshold;
+    QAtomicInt next_image;          // counts images, then frame runs
+    QAtomicInt failed_workers;      // Tesseract could not be initialized
+    QAtomicInt failed_images;
+    QAtomicInt scanned_frames;
+    QAtomicInt unchanged_frames;
+    QMutex output_lock;
+};
+
+#endif // BATCH_OCR_H
@@ -0,0 +1,202 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QSettings>
+#include <QDebug>
+
+#include "utilities.h"
+#include "capture_engine.h"
+
+CaptureEngine::CaptureEngine(FrameSource *source, int camera, int ring_capacity,
+                             FrameRing::OverflowPolicy policy):
+    running(false), cameraId(camera), source(source), shm_writer(nullptr), events(nullptr)
+{
+    QSettings settings;
+    recorder = new VideoRecorder(settings.value("recording/queue", 16).toInt(),
+                                 settings.value("recording/drop_oldest", false).toBool()
+                                 ? VideoRecorder::DROP_OLDEST : VideoRecorder::DROP_NEWEST,
+                                 (int)(settings.value("recording/pre_roll", 3.0).toDouble() * 1000),
+                                 (int)(settings.value("recording/segment_seconds", 60.0).toDouble() * 1000));
+    post_roll = (qint64)(settings.value("recording/post_roll", 2.0).toDouble() * 1000000);
+    recorder->setMetrics(&pipeline_metrics);
+    connect(recorder, &VideoRecorder::videoSaved, this, &CaptureEngine::videoSaved);
+    ring = new FrameRing(ring_capacity + recorder->capacity(), policy);
+
+    video_saving_status = STOPPED;
+
+    motion_detecting_status = false;
+    motion_detected = false;
+    motion_lost_at = 0;
+}
+
+CaptureEngine::~CaptureEngine() {
+    // the recorder queue holds frames of the ring
+    delete recorder;
+    delete source;
+    delete ring;
+}
+
+CaptureEngine::MotionOverlay CaptureEngine::motionOverlay() const
+{
+    if(!motion_detecting_status) {
+        return MotionOverlay();
+    }
+    QMutexLocker locker(&overlay_lock);
+    return overlay;
+}
+
+void CaptureEngine::run() {
+    running = true;
+    Utilities::pinCurrentThread(cpu_affinity);
+    if(!source->open()) {
+        qDebug() << "Cannot open" << source->name();
+        running = false;
+        return;
+    }
+    qDebug() << "Capturing from" << source->name();
+
+    motion.reset();
+    if(!shm_name.isEmpty()) {
+        shm_writer = new ShmFrameWriter(shm_name);
+    }
+    recorder->start();
+
+    while(running) {
+        FrameSlot *slot = ring->beginWrite();
+        if(slot == nullptr) {
+            // every slot is held by a consumer: discard this frame cheaply
+            if(ring->isClosed() || !source->skip()) {
+                break;
+            }
+            pipeline_metrics.countDrop();
+            continue;
+        }
+        cv::Mat &frame = slot->image;
+        qint64 read_start = FrameRing::now();
+        if(!source->read(frame)) {
+            ring->abortWrite(slot);
+            break;
+        }
+        qint64 timestamp = FrameRing::now();
+        if(frame.empty()) {
+            ring->abortWrite(slot);
+            continue;
+        }
+        pipeline_metrics.record(PipelineMetrics::CAPTURE, timestamp - read_start);
+        pipeline_metrics.countFrame();
+        // while motion detection is armed the recorder also sees the frames
+        // before an event, for its pre-roll
+        bool recording = processFrame(frame, timestamp);
+        if(recording || (motion_detecting_status && recorder->preRollEnabled())) {
+            recorder->addFrame(ring->commitShared(slot, timestamp),
+                               motion_detected ? RecordingIndexEntry::MOTION : 0);
+        } else {
+            ring->commitWrite(slot, timestamp);
+        }
+        if(shm_writer != nullptr) {
+            // consumers only read committed slots, the image is still ours to read
+            shm_writer->publish(frame, frame.channels() == 3 ? SHM_BGR24 : SHM_GRAY8,
+                                slot->sequence, timestamp);
+        }
+    }
+
+    if(video_saving_status == STARTED || video_saving_status == STOPPING) {
+        stopSavingVideo();
+    }
+    recorder->finish();
+    recorder->wait();
+    qDebug() << source->name() << recorder->statistics();
+    qDebug() << source->name() << motion.statistics();
+    qDebug().noquote() << source->name() << PipelineMetrics::report(pipeline_metrics.snapshot());
+    source->close();
+    delete shm_writer;
+    shm_writer = nullptr;
+    running = false;
+}
+
+bool CaptureEngine::processFrame(cv::Mat &frame, qint64 timestamp)
+{
+    if(motion_detecting_status) {
+        motionDetect(frame, timestamp);
+    }
+    // keep recording for post_roll after the motion stops, a new motion
+    // within that time continues the same recording
+    if(video_saving_status == STARTED && !motion_detected && timestamp - motion_lost_at > post_roll) {
+        setVideoSavingStatus(STOPPING);
+    }
+    if(video_saving_status == STARTING) {
+        startSavingVideo();
+    }
+    if(video_saving_status == STOPPING) {
+        stopSavingVideo();
+    }
+
+    // frames stay BGR, as sources deliver them; the display swaps the
+    // channels on the GPU
+    return video_saving_status == STARTED;
+}
+
+void CaptureEngine::startSavingVideo()
+{
+    // the segments and the cover are written by the recorder thread
+    recorder->startRecording(Utilities::newSavedVideoName());
+    video_saving_status = STARTED;
+}
+
+void CaptureEngine::stopSavingVideo()
+{
+    video_saving_status = STOPPED;
+    recorder->stopRecording();
+}
+
+void CaptureEngine::motionDetect(const cv::Mat &frame, qint64 timestamp)
+{
+    qint64 start = FrameRing::now();
+    motion.apply(frame);
+    // only the zones that record start and keep a recording, any zone may
+    // send its own notification
+    const QVector<MotionZone> &zones = motion.currentConfig().zones;
+    const std::vector<MotionDetector::ZoneState> &states = motion.zoneStates();
+    bool has_motion = false;
+    for(int i = 0; i < zones.size(); i++) {
+        if(states[i].active && (zones[i].actions & MotionZone::RECORD)) {
+            has_motion = true;
+        }
+        if(states[i].started && (zones[i].actions & MotionZone::NOTIFY) && events != nullptr) {
+            // only queued here, sent by the dispatcher thread
+            events->post("motion", cameraId, zones[i].name);
+        }
+    }
+    if(!motion_detected && has_motion) {
+        motion_detected = true;
+        if(video_saving_status == STOPPED) {
+            setVideoSavingStatus(STARTING);
+        }
+    } else if (motion_detected && !has_motion) {
+        motion_detected = false;
+        motion_lost_at = timestamp;
+        qDebug() << "detected motion disappeared.";
+    }
+
+    if(motion.currentConfig().boxes) {
+        // drawn by the view, the ring frames also go to the recordings,
+        // shm and OCR
+        MotionOverlay latest;
+        for(int i = 0; i < zones.size(); i++) {
+            if(!zones[i].area.isNull()) {
+                latest.zones.append(zones[i].area);
+                latest.active.append(states[i].active);
+            }
+        }
+        for(const cv::Rect &box : motion.boxes()) {
+            latest.boxes.append(QRect(box.x, box.y, box.width, box.height));
+        }
+        QMutexLocker locker(&overlay_lock);
+        overlay = latest;
+    }
+    pipeline_metrics.record(PipelineMetrics::MOTION, FrameRing::now() - start);
+}
@@ -0,0 +1,125 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef CAPTURE_ENGINE_H
+#define CAPTURE_ENGINE_H
+
+#include <QList>
+#include <QMutex>
+#include <QRect>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+#include "opencv2/opencv.hpp"
+#include "opencv2/videoio.hpp"
+
+#include "event_dispatcher.h"
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "motion_detector.h"
+#include "pipeline_metrics.h"
+#include "shm_frame_ring.h"
+#include "video_recorder.h"
+
+using namespace std;
+
+// Capture thread shared by every camera type. It pulls frames from a
+// FrameSource into a FrameRing and does the motion detection on the way, so
+// sources only deal with their device. Recorded frames are handed to a
+// VideoRecorder thread as ring references. Every stage of the camera counts
+// into the same PipelineMetrics.
+class CaptureEngine : public QThread
+{
+    Q_OBJECT
+public:
+    // The engine takes ownership of source. The ring gets extra slots for
+    // the frames queued to the recorder. With FrameRing::BLOCK the capture
+    // waits for its consumers instead of dropping frames.
+    CaptureEngine(FrameSource *source, int camera = 0, int ring_capacity = 8,
+                  FrameRing::OverflowPolicy policy = FrameRing::DROP_OLDEST);
+    ~CaptureEngine();
+    void setRunning(bool run) {running = run; };
+    FrameRing *frames() {return ring; };
+    FrameSource *frameSource() {return source; };
+    VideoRecorder *videoRecorder() {return recorder; };
+    PipelineMetrics *metrics() {return &pipeline_metrics; };
+    int cameraID() const {return cameraId; };
+    // Cores the capture thread runs on, set before start().
+    void setCpuAffinity(const QList<int> &cpus) {cpu_affinity = cpus; };
+    // Also publishes every frame to the POSIX shared memory segment name,
+    // for other processes, see ShmFrameReader. Set before start().
+    void setSharedMemoryName(const QString &name) {shm_name = name; };
+    // Zones and thresholds of the motion detection, those of the first
+    // camera by default. Set before start().
+    void setMotionConfig(const MotionDetector::Config &config) {motion.setConfig(config); };
+    // Where motion notifications go, none when null. Not owned.
+    void setEventDispatcher(EventDispatcher *dispatcher) {events = dispatcher; };
+    enum VideoSavingStatus {
+                            STARTING,
+                            STARTED,
+                            STOPPING,
+                            STOPPED
+    };
+
+    void setVideoSavingStatus(VideoSavingStatus status) {video_saving_status = status; };
+    void setMotionDetectingStatus(bool status) {
+        motion_detecting_status = status;
+        motion_detected = false;
+        if(video_saving_status != STOPPED) video_saving_status = STOPPING;
+    };
+
+    // Motion zones and boxes of the last analysed frame, in frame
+    // coordinates, for the view to draw over it. The frames themselves are
+    // left as captured.
+    struct MotionOverlay {
+        QVector<QRect> zones;
+        QVector<bool> active;   // of each zone
+        QVector<QRect> boxes;
+    };
+    // Empty while motion detection is off. Safe from any thread.
+    MotionOverlay motionOverlay() const;
+
+protected:
+    void run() override;
+
+signals:
+    void videoSaved(QString name);
+
+private:
+    // Returns whether the frame is to be recorded.
+    bool processFrame(cv::Mat &frame, qint64 timestamp);
+    void startSavingVideo();
+    void stopSavingVideo();
+    void motionDetect(const cv::Mat &frame, qint64 timestamp);
+
+private:
+    bool running;
+    int cameraId;
+    FrameSource *source;
+    FrameRing *ring;
+    QList<int> cpu_affinity;
+    QString shm_name;
+    ShmFrameWriter *shm_writer;
+    EventDispatcher *events;
+    PipelineMetrics pipeline_metrics;
+
+    // video saving
+    VideoSavingStatus video_saving_status;
+    VideoRecorder *recorder;
+    qint64 post_roll;       // microseconds recorded after the motion stops
+
+    // motion analysis
+    bool motion_detecting_status;
+    bool motion_detected;
+    qint64 motion_lost_at;
+    MotionDetector motion;
+    mutable QMutex overlay_lock;
+    MotionOverlay overlay;
+};
+
+#endif // CAPTURE_ENGINE_H
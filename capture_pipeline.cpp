@@ -0,0 +1,159 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QSettings>
+#include <QStringList>
+#include <QThread>
+
+#include "utilities.h"
+#include "capture_pipeline.h"
+
+CapturePipeline::Config CapturePipeline::Config::fromSettings()
+{
+    QSettings settings;
+    Config config;
+    QStringList cameras = settings.value("capture/cameras", QStringList({"0"})).toStringList();
+    config.cameras.clear();
+    for(const QString &camera : cameras) {
+        bool ok;
+        int id = camera.trimmed().toInt(&ok);
+        if(ok) {
+            config.cameras.append(id);
+        }
+    }
+    if(config.cameras.isEmpty()) {
+        config.cameras.append(0);
+    }
+    for(const QString &cpus : settings.value("capture/cpus").toStringList()) {
+        config.cpus.append(parseCpus(cpus));
+    }
+    config.pin_threads = settings.value("capture/pin_threads", true).toBool();
+    return config;
+}
+
+void CapturePipeline::Config::save() const
+{
+    QSettings settings;
+    QStringList list;
+    for(int camera : cameras) {
+        list.append(QString::number(camera));
+    }
+    settings.setValue("capture/cameras", list);
+    list.clear();
+    for(const QList<int> &set : cpus) {
+        list.append(formatCpus(set));
+    }
+    settings.setValue("capture/cpus", list);
+    settings.setValue("capture/pin_threads", pin_threads);
+}
+
+QList<int> CapturePipeline::Config::cpusFor(int index) const
+{
+    if(!pin_threads) {
+        return QList<int>();
+    }
+    if(index < cpus.size() && !cpus[index].isEmpty()) {
+        return cpus[index];
+    }
+    // consecutive cores, wrapping around when there are more cameras than cores
+    int total = QThread::idealThreadCount();
+    int share = qMax(1, total / qMax(1, cameras.size()));
+    QList<int> set;
+    for(int i = 0; i < share; i++) {
+        set.append((index * share + i) % total);
+    }
+    return set;
+}
+
+int CapturePipeline::Config::workersFor(int index) const
+{
+    QList<int> set = cpusFor(index);
+    if(!set.isEmpty()) {
+        return qMax(1, set.size() - 1);
+    }
+    return qMax(1, (QThread::idealThreadCount() - 1) / qMax(1, cameras.size()));
+}
+
+QList<int> CapturePipeline::Config::parseCpus(const QString &text)
+{
+    QList<int> set;
+    for(const QString &part : text.split(',', QString::SkipEmptyParts)) {
+        QStringList range = part.trimmed().split('-');
+        bool ok_first, ok_last = true;
+        int first = range[0].toInt(&ok_first);
+        int last = range.size() > 1 ? range[1].toInt(&ok_last) : first;
+        if(!ok_first || !ok_last || range.size() > 2) {
+            continue;
+        }
+        for(int cpu = first; cpu <= last; cpu++) {
+            if(!set.contains(cpu)) {
+                set.append(cpu);
+            }
+        }
+    }
+    return set;
+}
+
+QString CapturePipeline::Config::formatCpus(const QList<int> &cpus)
+{
+    QStringList parts;
+    for(int i = 0; i < cpus.size(); i++) {
+        int last = i;
+        while(last + 1 < cpus.size() && cpus[last + 1] == cpus[last] + 1) {
+            last++;
+        }
+        parts.append(last == i ? QString::number(cpus[i])
+                     : QString("%1-%2").arg(cpus[i]).arg(cpus[last]));
+        i = last;
+    }
+    return parts.join(',');
+}
+
+CapturePipeline::CapturePipeline(int index, FrameSource *source, int camera, const QList<int> &cpus,
+                                 int worker_count, bool every_frame, QObject *parent):
+    QObject(parent), pipeline_index(index), every_frame(every_frame)
+{
+    // recognition runs on the cores of this camera only
+    tesseract_pool = new TesseractPool(cpus.isEmpty() ? worker_count : cpus.size(), cpus);
+    ocr_pool = new OcrWorkerPool(tesseract_pool, worker_count, cpus);
+    ocr_pool->setRegionsOfInterest(Utilities::loadRegionsOfInterest(index));
+    ocr_pool->setDropStale(!every_frame);
+    // slots are also held by queued and running OCR jobs, which then hold
+    // back the capture instead of being dropped
+    capture = new CaptureEngine(source, camera, 2 * qMax(1, ocr_pool->workerCount()) + 4,
+                                every_frame ? FrameRing::BLOCK : FrameRing::DROP_OLDEST);
+    capture->setCpuAffinity(cpus);
+    // zones are kept per view, like the regions of interest
+    capture->setMotionConfig(MotionDetector::Config::fromSettings(index));
+    ocr_pool->setMetrics(capture->metrics());
+    if(QSettings().value("shm/publish", false).toBool()) {
+        capture->setSharedMemoryName(QString("/hsk_vision.%1").arg(index));
+    }
+
+    // emitted from worker threads and queued to this object, so nothing is
+    // delivered once the pipeline is gone
+    connect(ocr_pool, &OcrWorkerPool::textRecognized, this,
+            [this](quint64 sequence, QString text, QVector<QRect> areas) {
+        emit textRecognized(pipeline_index, sequence, text, areas);
+    });
+}
+
+CapturePipeline::~CapturePipeline()
+{
+    capture->setRunning(false);
+    capture->frames()->close();
+    capture->wait();
+    // the OCR jobs hold frames of the ring, drop them before the ring
+    delete ocr_pool;
+    delete tesseract_pool;
+    delete capture;
+}
+
+void CapturePipeline::start()
+{
+    capture->start();
+}
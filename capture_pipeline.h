@@ -0,0 +1,78 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef CAPTURE_PIPELINE_H
+#define CAPTURE_PIPELINE_H
+
+#include <QObject>
+#include <QList>
+#include <QVector>
+#include <QRect>
+#include <QString>
+
+#include "capture_engine.h"
+#include "ocr_worker.h"
+#include "tesseract_pool.h"
+
+// One camera with its own capture thread, frame ring and OCR workers. With
+// several cameras each pipeline can be pinned to its own cores, so they
+// scale across the machine instead of contending for the same ones.
+class CapturePipeline : public QObject
+{
+    Q_OBJECT
+public:
+    struct Config {
+        QList<int> cameras = {0};
+        QList<QList<int>> cpus;     // per camera, empty for an even share
+        bool pin_threads = true;
+        // every frame is captured and recognized, none dropped, to benchmark
+        // a replay; not saved
+        bool every_frame = false;
+
+        static Config fromSettings();
+        void save() const;
+        // Cores of the index-th camera, empty when threads are not pinned.
+        QList<int> cpusFor(int index) const;
+        // OCR workers of the index-th camera, one core is left to capture.
+        int workersFor(int index) const;
+
+        // "0-3,6" <-> {0, 1, 2, 3, 6}
+        static QList<int> parseCpus(const QString &text);
+        static QString formatCpus(const QList<int> &cpus);
+    };
+
+    // Takes ownership of source. The Tesseract instances, the regions of
+    // interest and the motion zones are those of this camera alone, the last
+    // two saved under index, not under the device id camera. With
+    // every_frame the capture waits for OCR instead of dropping frames, the
+    // reader of the ring must then submit every frame, not only the latest.
+    CapturePipeline(int index, FrameSource *source, int camera, const QList<int> &cpus,
+                    int worker_count, bool every_frame = false, QObject *parent = nullptr);
+    // Stops and joins the capture and OCR threads.
+    ~CapturePipeline();
+
+    void start();
+    int index() const {return pipeline_index; };
+    bool everyFrame() const {return every_frame; };
+    CaptureEngine *engine() {return capture; };
+    OcrWorkerPool *ocr() {return ocr_pool; };
+
+signals:
+    // Delivered in the thread of the pipeline, usually the GUI one. Frames
+    // are not signalled, the GUI reads the latest one from the ring at its
+    // own pace.
+    void textRecognized(int index, quint64 sequence, QString text, QVector<QRect> areas);
+
+private:
+    int pipeline_index;
+    bool every_frame;
+    TesseractPool *tesseract_pool;
+    OcrWorkerPool *ocr_pool;
+    CaptureEngine *capture;
+};
+
+#endif // CAPTURE_PIPELINE_H
@@ -0,0 +1,62 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+
+#include "change_detector.h"
+
+ChangeDetector::ChangeDetector(double threshold, cv::Size grid):
+    threshold(threshold), grid(grid),
+    thumbnail_size(grid.width * 8, grid.height * 8)
+{
+}
+
+bool ChangeDetector::update(const cv::Mat &frame)
+{
+    cv::resize(frame, scaled, thumbnail_size, 0, 0, cv::INTER_AREA);
+    if(scaled.channels() == 3) {
+        cv::cvtColor(scaled, thumbnail, cv::COLOR_BGR2GRAY);
+    } else {
+        scaled.copyTo(thumbnail);
+    }
+
+    if(reference.empty() || threshold <= 0) {
+        changed = cv::Mat(grid, CV_8U, cv::Scalar(255));
+        thumbnail.copyTo(reference);
+        return true;
+    }
+
+    // averaging the difference over each cell gives the per-cell mean
+    cv::absdiff(thumbnail, reference, difference);
+    cv::resize(difference, cell_difference, grid, 0, 0, cv::INTER_AREA);
+    cv::threshold(cell_difference, changed, threshold, 255, cv::THRESH_BINARY);
+    if(cv::countNonZero(changed) == 0) {
+        return false;
+    }
+    thumbnail.copyTo(reference);
+    return true;
+}
+
+void ChangeDetector::reset()
+{
+    reference.release();
+}
+
+bool ChangeDetector::intersects(const cv::Mat &cells, const cv::Rect &area, const cv::Size &frame_size)
+{
+    if(cells.empty() || frame_size.area() == 0) {
+        return true;
+    }
+    int x0 = std::max(0, area.x * cells.cols / frame_size.width);
+    int y0 = std::max(0, area.y * cells.rows / frame_size.height);
+    int x1 = std::min(cells.cols, (area.x + area.width) * cells.cols / frame_size.width + 1);
+    int y1 = std::min(cells.rows, (area.y + area.height) * cells.rows / frame_size.height + 1);
+    if(x1 <= x0 || y1 <= y0) {
+        return false;
+    }
+    return cv::countNonZero(cells(cv::Rect(x0, y0, x1 - x0, y1 - y0))) > 0;
+}
@@ -0,0 +1,46 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef CHANGE_DETECTOR_H
+#define CHANGE_DETECTOR_H
+
+#include "opencv2/opencv.hpp"
+
+// Cheap scene change test in front of OCR. Frames are reduced to a small
+// grayscale thumbnail and compared with the thumbnail of the last frame that
+// was reported as changed, cell by cell, so slow drift still adds up to a
+// change. All buffers are reused between frames.
+class ChangeDetector
+{
+public:
+    // threshold is the mean absolute difference (0-255) above which a cell
+    // counts as changed; 0 reports every frame as changed.
+    explicit ChangeDetector(double threshold = 8.0, cv::Size grid = cv::Size(16, 12));
+
+    // Returns true when any cell differs from the reference frame, and then
+    // makes frame the new reference.
+    bool update(const cv::Mat &frame);
+    void reset();
+
+    // Map of the cells changed by the last update(), 255 where changed.
+    const cv::Mat &changedCells() const {return changed; };
+    // True when area, in frame coordinates, touches a changed cell.
+    static bool intersects(const cv::Mat &cells, const cv::Rect &area, const cv::Size &frame_size);
+
+private:
+    double threshold;
+    cv::Size grid;
+    cv::Size thumbnail_size;
+    cv::Mat scaled;
+    cv::Mat thumbnail;
+    cv::Mat reference;
+    cv::Mat difference;
+    cv::Mat cell_difference;
+    cv::Mat changed;
+};
+
+#endif // CHANGE_DETECTOR_H
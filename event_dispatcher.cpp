@@ -0,0 +1,277 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QDateTime>
+#include <QDir>
+#include <QHostInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSettings>
+#include <QDebug>
+
+#include "event_dispatcher.h"
+#include "frame_ring.h"
+#include "utilities.h"
+
+EventSink *EventSink::fromSettings()
+{
+    QSettings settings;
+    QString type = settings.value("events/sink", "http").toString();
+    if(type == "http") {
+        // CHANGE events/url TO YOURS, e.g.:
+        // https://maker.ifttt.com/trigger/Motion-Detected-by-Gazer/with/key/-YOUR_KEY
+        return new HttpEventSink(QUrl(settings.value("events/url", "https://maker.ifttt.com/trigger/...").toString()),
+                                 settings.value("events/timeout", 10000).toInt());
+    }
+    if(type == "file") {
+        return new FileEventSink(settings.value("events/file",
+            QDir(Utilities::getDataPath()).absoluteFilePath("events.jsonl")).toString());
+    }
+    if(type == "socket") {
+        return new LocalSocketEventSink(settings.value("events/socket", "hsk_vision_events").toString());
+    }
+    return nullptr;
+}
+
+HttpEventSink::HttpEventSink(const QUrl &url, int timeout_ms):
+    url(url), timeout(timeout_ms), manager(new QNetworkAccessManager(this))
+{
+}
+
+void HttpEventSink::send(const QByteArray &payload)
+{
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    QNetworkReply *reply = manager->post(request, payload);
+    // Qt 5.12 has no transfer timeout of its own
+    QTimer::singleShot(timeout, reply, &QNetworkReply::abort);
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        bool ok = reply->error() == QNetworkReply::NoError;
+        if(!ok) {
+            qDebug() << "Event not delivered to" << url.toString() << reply->errorString();
+        }
+        reply->deleteLater();
+        emit finished(ok);
+    });
+}
+
+FileEventSink::FileEventSink(const QString &path):
+    file(path)
+{
+}
+
+void FileEventSink::send(const QByteArray &payload)
+{
+    if(!file.isOpen() && !file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qDebug() << "Cannot open" << file.fileName() << file.errorString();
+        emit finished(false);
+        return;
+    }
+    bool ok = file.write(payload + '\n') == payload.size() + 1 && file.flush();
+    emit finished(ok);
+}
+
+LocalSocketEventSink::LocalSocketEventSink(const QString &server):
+    server(server), socket(new QLocalSocket(this))
+{
+}
+
+void LocalSocketEventSink::send(const QByteArray &payload)
+{
+    // waiting is fine here, only the thread of the dispatcher waits and a
+    // local server answers at once or not at all
+    if(socket->state() != QLocalSocket::ConnectedState) {
+        socket->abort();
+        socket->connectToServer(server);
+        if(!socket->waitForConnected(1000)) {
+            qDebug() << "Cannot connect to" << server << socket->errorString();
+            emit finished(false);
+            return;
+        }
+    }
+    socket->write(payload + '\n');
+    bool ok = socket->waitForBytesWritten(1000);
+    if(!ok) {
+        qDebug() << "Event not delivered to" << server << socket->errorString();
+        socket->abort();
+    }
+    emit finished(ok);
+}
+
+EventDispatcher::EventDispatcher(QObject *parent):
+    EventDispatcher(&EventSink::fromSettings, parent)
+{
+}
+
+EventDispatcher::EventDispatcher(std::function<EventSink *()> make_sink, QObject *parent):
+    QThread(parent), wake_timer(nullptr), make_sink(make_sink), sink(nullptr), sending(false),
+    sent(0), merged(0), dropped(0), failed(0), retries(0)
+{
+    QSettings settings;
+    queue_capacity = qMax(1, settings.value("events/queue", 64).toInt());
+    min_interval = (qint64)(settings.value("events/min_interval", 30.0).toDouble() * 1000000);
+    max_attempts = qMax(1, settings.value("events/attempts", 5).toInt());
+}
+
+EventDispatcher::~EventDispatcher()
+{
+    quit();
+    wait();
+}
+
+QString EventDispatcher::key(const QString &type, int camera)
+{
+    return QString("%1/%2").arg(type).arg(camera);
+}
+
+bool EventDispatcher::post(const QString &type, int camera, const QString &detail)
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&queue_lock);
+    for(Event &event : events) {
+        if(event.type == type && event.camera == camera) {
+            // already waiting its turn, it now stands for one more
+            event.count++;
+            event.last_time = now;
+            event.detail = detail;
+            merged++;
+            return true;
+        }
+    }
+    if((int)events.size() >= queue_capacity) {
+        dropped++;
+        return false;
+    }
+    events.push_back(Event{type, camera, detail, now, now, 1, 0, FrameRing::now()});
+    if(wake_timer != nullptr) {
+        QMetaObject::invokeMethod(wake_timer, [this]() { dispatch(); }, Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void EventDispatcher::run()
+{
+    sink = make_sink ? make_sink() : nullptr;
+    QTimer timer;
+    timer.setSingleShot(true);
+    // the timer and the sink live in this thread, so do their handlers
+    connect(&timer, &QTimer::timeout, &timer, [this]() { dispatch(); });
+    if(sink != nullptr) {
+        connect(sink, &EventSink::finished, sink, [this](bool ok) { sendFinished(ok); },
+                Qt::QueuedConnection);
+        qDebug() << "Sending events to" << sink->name();
+    }
+    {
+        QMutexLocker locker(&queue_lock);
+        wake_timer = &timer;
+    }
+    dispatch();
+    exec();
+    {
+        QMutexLocker locker(&queue_lock);
+        wake_timer = nullptr;
+    }
+    delete sink;
+    sink = nullptr;
+    sending = false;
+}
+
+void EventDispatcher::dispatch()
+{
+    if(sending) {
+        return;
+    }
+    qint64 now = FrameRing::now();
+    qint64 next_due = -1;
+    {
+        QMutexLocker locker(&queue_lock);
+        if(sink == nullptr) {
+            // events/sink is none
+            dropped += events.size();
+            events.clear();
+            return;
+        }
+        for(auto it = events.begin(); it != events.end(); ++it) {
+            QString event_key = key(it->type, it->camera);
+            qint64 due = last_sent.contains(event_key)
+                ? qMax(it->due, last_sent.value(event_key) + min_interval) : it->due;
+            if(due <= now) {
+                in_flight = *it;
+                events.erase(it);
+                sending = true;
+                break;
+            }
+            if(next_due < 0 || due < next_due) {
+                next_due = due;
+            }
+        }
+    }
+    if(sending) {
+        sink->send(payload(in_flight));
+    } else if(next_due >= 0) {
+        wake_timer->start((int)((next_due - now + 999) / 1000));
+    }
+}
+
+void EventDispatcher::sendFinished(bool ok)
+{
+    sending = false;
+    {
+        QMutexLocker locker(&queue_lock);
+        if(ok) {
+            sent++;
+            last_sent.insert(key(in_flight.type, in_flight.camera), FrameRing::now());
+        } else if(++in_flight.attempts < max_attempts) {
+            retries++;
+            // 1 s, 2 s, 4 s... up to a minute
+            in_flight.due = FrameRing::now() + qMin((qint64)1000000 << (in_flight.attempts - 1), (qint64)60000000);
+            bool merged_again = false;
+            for(Event &event : events) {
+                if(event.type == in_flight.type && event.camera == in_flight.camera) {
+                    event.count += in_flight.count;
+                    event.first_time = in_flight.first_time;
+                    event.attempts = in_flight.attempts;
+                    event.due = qMax(event.due, in_flight.due);
+                    merged_again = true;
+                    break;
+                }
+            }
+            if(!merged_again) {
+                events.push_front(in_flight);
+            }
+        } else {
+            failed++;
+            qDebug() << "Event" << in_flight.type << "of camera" << in_flight.camera
+                     << "dropped after" << in_flight.attempts << "attempts";
+        }
+    }
+    dispatch();
+}
+
+QByteArray EventDispatcher::payload(const Event &event)
+{
+    QJsonObject json;
+    // value1 and value2 are what the IFTTT webhook passes on
+    json.insert("value1", QString::number(event.camera));
+    json.insert("value2", QHostInfo::localHostName());
+    json.insert("event", event.type);
+    json.insert("camera", event.camera);
+    json.insert("detail", event.detail);
+    json.insert("count", event.count);
+    json.insert("first", QDateTime::fromMSecsSinceEpoch(event.first_time).toString(Qt::ISODateWithMs));
+    json.insert("last", QDateTime::fromMSecsSinceEpoch(event.last_time).toString(Qt::ISODateWithMs));
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QString EventDispatcher::statistics() const
+{
+    QMutexLocker locker(&queue_lock);
+    return QString("events sent %1, merged %2, retried %3, failed %4, dropped %5")
+        .arg(sent).arg(merged).arg(retries).arg(failed).arg(dropped);
+}
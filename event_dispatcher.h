@@ -0,0 +1,155 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef EVENT_DISPATCHER_H
+#define EVENT_DISPATCHER_H
+
+#include <deque>
+#include <functional>
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QNetworkAccessManager>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+
+// Where events end up. send() is only called again once finished() was
+// emitted for the previous payload, which is one JSON object.
+class EventSink : public QObject
+{
+    Q_OBJECT
+public:
+    virtual void send(const QByteArray &payload) = 0;
+    virtual QString name() const = 0;
+
+    // From events/sink: http (the default), file, socket or none.
+    static EventSink *fromSettings();
+
+signals:
+    void finished(bool ok);
+};
+
+// POSTs the payload, e.g. to a webhook that notifies phones.
+class HttpEventSink : public EventSink
+{
+    Q_OBJECT
+public:
+    HttpEventSink(const QUrl &url, int timeout_ms = 10000);
+    void send(const QByteArray &payload) override;
+    QString name() const override { return url.toString(); };
+
+private:
+    QUrl url;
+    int timeout;
+    QNetworkAccessManager *manager;
+};
+
+// Appends the payload as a line to a file.
+class FileEventSink : public EventSink
+{
+    Q_OBJECT
+public:
+    explicit FileEventSink(const QString &path);
+    void send(const QByteArray &payload) override;
+    QString name() const override { return file.fileName(); };
+
+private:
+    QFile file;
+};
+
+// Writes the payload as a line to a local (Unix domain) socket, kept
+// connected between events.
+class LocalSocketEventSink : public EventSink
+{
+    Q_OBJECT
+public:
+    explicit LocalSocketEventSink(const QString &server);
+    void send(const QByteArray &payload) override;
+    QString name() const override { return server; };
+
+private:
+    QString server;
+    QLocalSocket *socket;
+};
+
+// Delivers events, such as motion starting, from any thread without ever
+// blocking it. post() only queues the event; one long-lived sink sends them
+// from the thread of the dispatcher, one at a time. A repeated event of a
+// camera that is still queued is merged into it, and an event is sent at
+// most once every events/min_interval seconds per camera, with the number
+// of occurrences it stands for. Failed sends are retried with an exponential
+// backoff, and the queue is bounded: when full, new events are dropped.
+class EventDispatcher : public QThread
+{
+    Q_OBJECT
+public:
+    explicit EventDispatcher(QObject *parent = nullptr);
+    // Sends to the sink made by make_sink, called in the thread of the
+    // dispatcher, instead of the one of the settings, e.g. for tests.
+    explicit EventDispatcher(std::function<EventSink *()> make_sink, QObject *parent = nullptr);
+    // Stops the thread; events still queued are lost.
+    ~EventDispatcher();
+
+    // Thread safe. Returns false when the event was dropped.
+    bool post(const QString &type, int camera, const QString &detail = QString());
+
+    quint64 sentEvents() const { return sent; };
+    quint64 mergedEvents() const { return merged; };
+    quint64 droppedEvents() const { return dropped; };
+    QString statistics() const;
+
+protected:
+    void run() override;
+
+private:
+    struct Event {
+        QString type;
+        int camera;
+        QString detail;
+        qint64 first_time;  // ms since the epoch
+        qint64 last_time;
+        int count;
+        int attempts;
+        qint64 due;         // FrameRing::now(), not sent before
+    };
+
+    static QString key(const QString &type, int camera);
+    static QByteArray payload(const Event &event);
+    // Only run in the thread of the dispatcher.
+    void dispatch();
+    void sendFinished(bool ok);
+
+private:
+    int queue_capacity;
+    qint64 min_interval;    // microseconds
+    int max_attempts;
+    mutable QMutex queue_lock;
+    std::deque<Event> events;
+    QHash<QString, qint64> last_sent;
+    // lives in the thread of the dispatcher while it runs, null otherwise
+    QTimer *wake_timer;
+
+    // only used by the dispatcher thread
+    std::function<EventSink *()> make_sink;
+    EventSink *sink;
+    bool sending;
+    Event in_flight;
+
+    // statistics, written with queue_lock held
+    quint64 sent;
+    quint64 merged;
+    quint64 dropped;
+    quint64 failed;
+    quint64 retries;
+};
+
+#endif // EVENT_DISPATCHER_H
@@ -0,0 +1,224 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <chrono>
+#include <utility>
+#include <QThread>
+
+#include "frame_ring.h"
+
+FrameRef::FrameRef():
+    ring(nullptr), slot(nullptr)
+{
+}
+
+FrameRef::FrameRef(FrameRing *ring, FrameSlot *slot):
+    ring(ring), slot(slot)
+{
+}
+
+FrameRef::FrameRef(const FrameRef &other):
+    ring(other.ring), slot(other.slot)
+{
+    if(slot != nullptr) {
+        ring->addRef(slot);
+    }
+}
+
+FrameRef::FrameRef(FrameRef &&other):
+    ring(other.ring), slot(other.slot)
+{
+    other.ring = nullptr;
+    other.slot = nullptr;
+}
+
+FrameRef &FrameRef::operator=(FrameRef other)
+{
+    std::swap(ring, other.ring);
+    std::swap(slot, other.slot);
+    return *this;
+}
+
+FrameRef::~FrameRef()
+{
+    if(slot != nullptr) {
+        ring->release(slot);
+    }
+}
+
+IndexQueue::IndexQueue(int capacity)
+{
+    size_t size = 2;
+    while(size < (size_t)capacity) {
+        size <<= 1;
+    }
+    cells.reset(new Cell[size]);
+    for(size_t i = 0; i < size; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mask = size - 1;
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos.store(0, std::memory_order_relaxed);
+}
+
+bool IndexQueue::push(int value)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for(;;) {
+        cell = &cells[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0) {
+            if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->value = value;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool IndexQueue::pop(int &value)
+{
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for(;;) {
+        cell = &cells[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(diff == 0) {
+            if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    value = cell->value;
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+}
+
+FrameRing::FrameRing(int capacity, OverflowPolicy policy):
+    slot_count(capacity), policy(policy), slot_pool(new FrameSlot[capacity]),
+    free_slots(capacity), ready_slots(capacity),
+    closed(false), next_sequence(0), written(0), dropped(0), skipped(0)
+{
+    for(int i = 0; i < slot_count; i++) {
+        slot_pool[i].sequence = 0;
+        slot_pool[i].timestamp = 0;
+        slot_pool[i].index = i;
+        slot_pool[i].refs.store(0, std::memory_order_relaxed);
+        free_slots.push(i);
+    }
+}
+
+FrameRing::~FrameRing()
+{
+}
+
+FrameSlot *FrameRing::beginWrite()
+{
+    int index;
+    while(!free_slots.pop(index)) {
+        if(isClosed()) {
+            return nullptr;
+        }
+        if(policy == DROP_OLDEST) {
+            // drop the reference of the ready queue to the oldest unread
+            // frame; unless a handle shares it, the slot is free again
+            if(ready_slots.pop(index)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                release(&slot_pool[index]);
+                continue;
+            }
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        QThread::usleep(100);
+    }
+    return &slot_pool[index];
+}
+
+void FrameRing::commitWrite(FrameSlot *slot, qint64 timestamp)
+{
+    slot->sequence = next_sequence.fetch_add(1, std::memory_order_relaxed);
+    slot->timestamp = timestamp;
+    slot->refs.store(1, std::memory_order_relaxed);
+    written.fetch_add(1, std::memory_order_relaxed);
+    ready_slots.push(slot->index);
+}
+
+FrameRef FrameRing::commitShared(FrameSlot *slot, qint64 timestamp)
+{
+    slot->sequence = next_sequence.fetch_add(1, std::memory_order_relaxed);
+    slot->timestamp = timestamp;
+    // one reference for the ready queue, one for the returned handle
+    slot->refs.store(2, std::memory_order_relaxed);
+    written.fetch_add(1, std::memory_order_relaxed);
+    ready_slots.push(slot->index);
+    return FrameRef(this, slot);
+}
+
+void FrameRing::abortWrite(FrameSlot *slot)
+{
+    free_slots.push(slot->index);
+}
+
+FrameRef FrameRing::read()
+{
+    int index;
+    if(!ready_slots.pop(index)) {
+        return FrameRef();
+    }
+    // the handle adopts the reference held by the ready queue
+    return FrameRef(this, &slot_pool[index]);
+}
+
+FrameRef FrameRing::readLatest()
+{
+    FrameRef latest = read();
+    if(latest.isNull()) {
+        return latest;
+    }
+    for(FrameRef next = read(); !next.isNull(); next = read()) {
+        skipped.fetch_add(1, std::memory_order_relaxed);
+        latest = std::move(next);
+    }
+    return latest;
+}
+
+void FrameRing::close()
+{
+    closed.store(true, std::memory_order_release);
+}
+
+qint64 FrameRing::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FrameRing::addRef(FrameSlot *slot)
+{
+    slot->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameRing::release(FrameSlot *slot)
+{
+    if(slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        free_slots.push(slot->index);
+    }
+}
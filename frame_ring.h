@@ -0,0 +1,133 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+#include <memory>
+#include <QtGlobal>
+#include <QMetaType>
+
+#include "opencv2/opencv.hpp"
+
+class FrameRing;
+
+struct FrameSlot
+{
+    cv::Mat image;      // BGR or gray, as the source delivers it
+    quint64 sequence;
+    qint64 timestamp;   // capture time, see FrameRing::now()
+    int index;
+    std::atomic<int> refs;
+};
+
+// Reference counted handle to a filled slot. The slot goes back to the free
+// list of its ring when the last handle is dropped, so consumers must not
+// keep cv::Mat copies of image() beyond the lifetime of the handle.
+class FrameRef
+{
+public:
+    FrameRef();
+    FrameRef(const FrameRef &other);
+    FrameRef(FrameRef &&other);
+    FrameRef &operator=(FrameRef other);
+    ~FrameRef();
+
+    bool isNull() const { return slot == nullptr; };
+    const cv::Mat &image() const { return slot->image; };
+    quint64 sequence() const { return slot->sequence; };
+    qint64 timestamp() const { return slot->timestamp; };
+
+private:
+    friend class FrameRing;
+    FrameRef(FrameRing *ring, FrameSlot *slot);
+
+    FrameRing *ring;
+    FrameSlot *slot;
+};
+
+Q_DECLARE_METATYPE(FrameRef)
+
+// Bounded lock-free queue of slot indices (Vyukov MPMC algorithm).
+class IndexQueue
+{
+public:
+    explicit IndexQueue(int capacity);
+    bool push(int value);
+    bool pop(int &value);
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        int value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+};
+
+// Fixed pool of preallocated frame slots shared between a capture thread and
+// its consumers. Producers fill a slot obtained from beginWrite() and publish
+// it with commitWrite(); consumers take published frames with read() or
+// readLatest(). Slot images are reused, so there is no per-frame allocation
+// once the first frame of a given size has been captured.
+class FrameRing
+{
+public:
+    enum OverflowPolicy {
+                         DROP_OLDEST,   // recycle the oldest unread frame
+                         BLOCK          // wait until a consumer releases one
+    };
+
+    explicit FrameRing(int capacity = 8, OverflowPolicy policy = DROP_OLDEST);
+    ~FrameRing();
+
+    // Returns nullptr when every slot is held by consumers (the incoming
+    // frame is then counted as dropped) or when the ring has been closed.
+    FrameSlot *beginWrite();
+    void commitWrite(FrameSlot *slot, qint64 timestamp);
+    // Publishes the slot like commitWrite() and also returns a handle to it,
+    // for a producer that hands the frame to its own consumers as well.
+    FrameRef commitShared(FrameSlot *slot, qint64 timestamp);
+    void abortWrite(FrameSlot *slot);
+
+    FrameRef read();
+    // Returns the newest published frame, releasing any older unread ones.
+    FrameRef readLatest();
+
+    void close();
+    bool isClosed() const { return closed.load(std::memory_order_acquire); };
+
+    int capacity() const { return slot_count; };
+    quint64 writtenFrames() const { return written.load(std::memory_order_relaxed); };
+    quint64 droppedFrames() const { return dropped.load(std::memory_order_relaxed); };
+    quint64 skippedFrames() const { return skipped.load(std::memory_order_relaxed); };
+
+    // Monotonic clock used for capture timestamps, in microseconds.
+    static qint64 now();
+
+private:
+    friend class FrameRef;
+    void addRef(FrameSlot *slot);
+    void release(FrameSlot *slot);
+
+private:
+    int slot_count;
+    OverflowPolicy policy;
+    std::unique_ptr<FrameSlot[]> slot_pool;
+    IndexQueue free_slots;
+    IndexQueue ready_slots;
+    std::atomic<bool> closed;
+    std::atomic<quint64> next_sequence;
+    std::atomic<quint64> written;
+    std::atomic<quint64> dropped;
+    std::atomic<quint64> skipped;
+};
+
+#endif // FRAME_RING_H
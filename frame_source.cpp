@@ -0,0 +1,206 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QThread>
+
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "recording.h"
+
+SyntheticFrameSource::SyntheticFrameSource(cv::Size size, int type, double fps, QString label):
+    size(size), type(type), rate(fps), label(label), frame_count(0), next_due(0)
+{
+}
+
+bool SyntheticFrameSource::open()
+{
+    frame_count = 0;
+    next_due = FrameRing::now();
+    return true;
+}
+
+bool SyntheticFrameSource::read(cv::Mat &frame)
+{
+    // keep the nominal rate
+    qint64 wait = next_due - FrameRing::now();
+    if(wait > 0) {
+        QThread::usleep(wait);
+    }
+    next_due += (qint64)(1000000 / rate);
+
+    // draw in place so the buffer is allocated only once
+    frame.create(size, type);
+    int shift = frame_count % size.width;
+    int channels = frame.channels();
+    for(int y = 0; y < size.height; y++) {
+        uchar *row = frame.ptr<uchar>(y);
+        for(int x = 0; x < size.width; x++) {
+            uchar value = (uchar)((x + shift) % size.width * 255 / size.width);
+            for(int c = 0; c < channels; c++) {
+                row[x * channels + c] = value;
+            }
+        }
+    }
+    int block = size.height / 4;
+    int block_x = (int)(frame_count * 4 % (size.width + block)) - block;
+    cv::rectangle(frame, cv::Rect(block_x, size.height - block - 10, block, block),
+                  cv::Scalar(0, 0, 255), cv::FILLED);
+    QString text = QString("%1 %2").arg(label).arg(frame_count++);
+    cv::putText(frame, text.toStdString(), cv::Point(40, size.height / 2),
+                cv::FONT_HERSHEY_SIMPLEX, 3.0, cv::Scalar(0, 0, 0), 6);
+    return true;
+}
+
+void SyntheticFrameSource::close()
+{
+}
+
+VideoFileFrameSource::VideoFileFrameSource(QString path, Pacing pacing, bool loop):
+    path(path), pacing(pacing), loop(loop), recording(nullptr), next_frame(0),
+    frame_rate(0), duration_ms(0), frames_read(0),
+    seek_request(-1), position_ms(0), loop_count(0), origin_set(false), origin_media(0), origin_wall(0)
+{
+}
+
+VideoFileFrameSource::~VideoFileFrameSource()
+{
+    delete recording;
+}
+
+bool VideoFileFrameSource::open()
+{
+    if(RecordingReader::isRecording(path)) {
+        recording = new RecordingReader();
+        if(!recording->open(path)) {
+            return false;
+        }
+        duration_ms = (recording->endTime() - recording->startTime()) / 1000;
+        frame_rate = duration_ms > 0 ? (recording->frameCount() - 1) * 1000.0 / duration_ms : 30;
+        next_frame = 0;
+        frames_read = 0;
+        origin_set = false;
+        return true;
+    }
+    if(!cap.open(path.toStdString())) {
+        return false;
+    }
+    frame_rate = cap.get(cv::CAP_PROP_FPS);
+    if(frame_rate <= 0 || frame_rate > 1000) {
+        frame_rate = 30;
+    }
+    duration_ms = (qint64)(cap.get(cv::CAP_PROP_FRAME_COUNT) * 1000 / frame_rate);
+    frames_read = 0;
+    origin_set = false;
+    return true;
+}
+
+bool VideoFileFrameSource::readFrame(cv::Mat *frame)
+{
+    if(recording != nullptr) {
+        return readRecordedFrame(frame);
+    }
+    qint64 seek_ms = seek_request.exchange(-1);
+    if(seek_ms >= 0) {
+        cap.set(cv::CAP_PROP_POS_MSEC, (double)seek_ms);
+        frames_read = (quint64)(seek_ms * frame_rate / 1000);
+        origin_set = false;
+    }
+    if(!cap.grab()) {
+        if(!loop || frames_read == 0) {
+            return false;
+        }
+        // start over, pacing restarts from the first frame
+        cap.set(cv::CAP_PROP_POS_FRAMES, 0);
+        frames_read = 0;
+        origin_set = false;
+        loop_count++;
+        if(!cap.grab()) {
+            return false;
+        }
+    }
+    frames_read++;
+    // the recorded time of the frame, counted from the frame rate when the
+    // container does not provide it
+    qint64 media_ms = (qint64)cap.get(cv::CAP_PROP_POS_MSEC);
+    if(media_ms <= 0 && frames_read > 1) {
+        media_ms = (qint64)((frames_read - 1) * 1000 / frame_rate);
+    }
+    position_ms.store(media_ms);
+    if(pacing == PACED) {
+        pace();
+    }
+    return frame == nullptr || cap.retrieve(*frame);
+}
+
+bool VideoFileFrameSource::readRecordedFrame(cv::Mat *frame)
+{
+    qint64 seek_ms = seek_request.exchange(-1);
+    if(seek_ms >= 0) {
+        next_frame = recording->findTimestamp(recording->startTime() + seek_ms * 1000);
+        origin_set = false;
+    }
+    if(next_frame >= recording->frameCount()) {
+        if(!loop || frames_read == 0) {
+            return false;
+        }
+        next_frame = 0;
+        origin_set = false;
+        loop_count++;
+    }
+    int index = next_frame++;
+    frames_read++;
+    // the capture times are in the index, skipped frames are not decoded
+    position_ms.store((recording->entry(index).timestamp - recording->startTime()) / 1000);
+    if(pacing == PACED) {
+        pace();
+    }
+    if(frame != nullptr && !recording->readFrame(index, *frame)) {
+        // a damaged image is passed over, the replay goes on
+        frame->release();
+    }
+    return true;
+}
+
+void VideoFileFrameSource::pace()
+{
+    qint64 media = position_ms.load() * 1000;
+    qint64 now = FrameRing::now();
+    // resynchronize after a seek, a loop or when too far behind
+    if(!origin_set || now - (origin_wall + media - origin_media) > 1000000) {
+        origin_set = true;
+        origin_media = media;
+        origin_wall = now;
+        return;
+    }
+    qint64 wait = origin_wall + (media - origin_media) - now;
+    if(wait > 0) {
+        QThread::usleep(wait);
+    }
+}
+
+bool VideoFileFrameSource::read(cv::Mat &frame)
+{
+    return readFrame(&frame);
+}
+
+bool VideoFileFrameSource::skip()
+{
+    // skipped frames keep their time slot, but are never decoded
+    return readFrame(nullptr);
+}
+
+void VideoFileFrameSource::close()
+{
+    cap.release();
+    delete recording;
+    recording = nullptr;
+}
+
+double VideoFileFrameSource::fps() const
+{
+    return frame_rate;
+}
@@ -0,0 +1,122 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <atomic>
+#include <QString>
+
+#include "opencv2/opencv.hpp"
+#include "opencv2/videoio.hpp"
+
+class RecordingReader;
+
+// Where CaptureEngine gets its frames from. Implementations only deal with
+// the device; buffering, recording, motion detection and metrics are done
+// once, in the engine.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+    virtual QString name() const = 0;
+    virtual bool open() = 0;
+    // Writes the next frame into frame, BGR or 8-bit gray, reusing its
+    // buffer when the size matches. Returns false at the end of the stream
+    // or on a device error; frame may be left empty when a source has
+    // nothing to deliver this time.
+    virtual bool read(cv::Mat &frame) = 0;
+    // Drops the next frame as cheaply as the device allows, used when every
+    // ring slot is busy.
+    virtual bool skip() { return read(skipped); };
+    virtual void close() = 0;
+    // Nominal frame rate, 0 when unknown.
+    virtual double fps() const { return 0; };
+
+protected:
+    cv::Mat skipped;
+};
+
+// Renders a moving test pattern with a frame counter and a moving block, at
+// a fixed rate, so capture, motion detection and recording can be exercised
+// without hardware.
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    SyntheticFrameSource(cv::Size size = cv::Size(1280, 720), int type = CV_8UC3,
+                         double fps = 30, QString label = "SYNTHETIC");
+    QString name() const override { return label; };
+    bool open() override;
+    bool read(cv::Mat &frame) override;
+    void close() override;
+    double fps() const override { return rate; };
+
+private:
+    cv::Size size;
+    int type;
+    double rate;
+    QString label;
+    quint64 frame_count;
+    qint64 next_due;
+};
+
+// Replays a video file with OpenCV, or a recording of the application (any
+// of its segment files) with RecordingReader. PACED delivers frames at the
+// times recorded in the file, to reproduce field conditions; UNTHROTTLED
+// delivers them as fast as they decode, to benchmark the rest of the
+// pipeline or to re-analyse recordings.
+class VideoFileFrameSource : public FrameSource
+{
+public:
+    enum Pacing {
+                 PACED,
+                 UNTHROTTLED
+    };
+
+    VideoFileFrameSource(QString path, Pacing pacing = PACED, bool loop = false);
+    ~VideoFileFrameSource();
+    QString name() const override { return path; };
+    bool open() override;
+    bool read(cv::Mat &frame) override;
+    bool skip() override;
+    void close() override;
+    double fps() const override;
+
+    // May be called from any thread, applied before the next frame.
+    void seek(double seconds) { seek_request.store((qint64)(seconds * 1000)); };
+    // Position of the last frame read and length of the file, in seconds.
+    double position() const { return position_ms.load() / 1000.0; };
+    double duration() const { return duration_ms / 1000.0; };
+    quint64 loops() const { return loop_count.load(); };
+
+private:
+    // frame is nullptr when skipping, the frame is then not decoded
+    bool readFrame(cv::Mat *frame);
+    bool readRecordedFrame(cv::Mat *frame);
+    void pace();
+
+private:
+    QString path;
+    Pacing pacing;
+    bool loop;
+    cv::VideoCapture cap;
+    RecordingReader *recording;     // nullptr for other files
+    int next_frame;
+    double frame_rate;
+    qint64 duration_ms;
+    quint64 frames_read;
+    std::atomic<qint64> seek_request;   // ms, -1 when none
+    std::atomic<qint64> position_ms;
+    std::atomic<quint64> loop_count;
+
+    // pacing origin: a media time and the wall clock time it was shown at
+    bool origin_set;
+    qint64 origin_media;
+    qint64 origin_wall;
+};
+
+#endif // FRAME_SOURCE_H
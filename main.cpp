@@ -7,9 +7,17 @@
 */
 #include <QApplication>
 #include "mainwindow.h"
+#include "batch_ocr.h"
 
 int main(int argc, char *argv[])
 {
+    QCoreApplication::setOrganizationName("HardSoftKoop");
+    QCoreApplication::setApplicationName("HSK Vision");
+    if (BatchOcr::requested(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        return BatchOcr::main(app.arguments());
+    }
+
     QApplication app(argc, argv);
     MainWindow window;
     window.setWindowTitle("HSK Vision v1.1");
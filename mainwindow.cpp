@@ -19,12 +19,23 @@
 #include <QIcon>
 #include <QStandardItem>
 #include <QSize>
+#include <QPen>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QSpinBox>
+#include <QLineEdit>
+#include <QInputDialog>
+#include <QSettings>
+#include <QScreen>
+#include <QtConcurrent>
 #include <unistd.h>
 
 #include "opencv2/videoio.hpp"
 
 #include "mainwindow.h"
 #include "screencapturer.h"
+#include "roiselector.h"
 #include "utilities.h"
 
 
@@ -35,20 +46,29 @@ MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent)
     , currentImage(nullptr)
     , tesseractAPI(nullptr)
+    , tesseractPool(nullptr)
 //    , fileMenu(nullptr)
-//    , capturer(nullptr)
 {
     initUI();
-    data_lock = new QMutex();
+    // one sender for the notifications of every camera
+    eventDispatcher = new EventDispatcher(this);
+    eventDispatcher->start();
+    // load and warm up the EAST network in the background
+    detectorLoading = QtConcurrent::run([this]() { return detector.load(); });
 }
 
 MainWindow::~MainWindow()
 {
     // Destroy used object and release memory
+    detectorLoading.waitForFinished();
     if(tesseractAPI != nullptr) {
         tesseractAPI->End();
         delete tesseractAPI;
     }
+    stopPipelines();
+    delete tesseractPool;
+    qDebug() << eventDispatcher->statistics();
+    delete eventDispatcher;
 }
 
 void MainWindow::initUI()
@@ -58,6 +78,7 @@ void MainWindow::initUI()
     imageMenu = menuBar()->addMenu("&Image");
     videoMenu = menuBar()->addMenu("&Video");
     videoUSBMenu = videoMenu->addMenu("USB");
+    replayMenu = videoMenu->addMenu("Replay");
     configMenu = menuBar()->addMenu("&Config");
     helpMenu = menuBar()->addMenu("&Help");
 
@@ -70,7 +91,11 @@ void MainWindow::initUI()
 
     imageScene = new QGraphicsScene(this);
     imageView = new QGraphicsView(imageScene);
-    splitter->addWidget(imageView);
+    videoWidget = new VideoWidget(this);
+    viewStack = new QStackedWidget(this);
+    viewStack->addWidget(imageView);
+    viewStack->addWidget(videoWidget);
+    splitter->addWidget(viewStack);
 
     editor = new QTextEdit(this);
     splitter->addWidget(editor);
@@ -85,6 +110,16 @@ void MainWindow::initUI()
     mainStatusLabel = new QLabel(mainStatusBar);
     mainStatusBar->addPermanentWidget(mainStatusLabel);
     mainStatusLabel->setText("Application information will be here!");
+    // the rates of the running cameras, next to the messages
+    telemetryLabel = new QLabel(mainStatusBar);
+    mainStatusBar->addPermanentWidget(telemetryLabel);
+
+    // the GUI takes frames at its own pace, whatever the capture rate
+    displayTimer = new QTimer(this);
+    displayTimer->setTimerType(Qt::PreciseTimer);
+    qreal refresh_rate = QGuiApplication::primaryScreen() != nullptr
+        ? QGuiApplication::primaryScreen()->refreshRate() : 60;
+    displayTimer->setInterval(qMax(1, qRound(1000 / qMax(refresh_rate, (qreal)1))));
 
     createActions();
 }
@@ -110,14 +145,44 @@ void MainWindow::createActions()
     imageMenu->addAction(exitAction);
     cameraInfoAction = new QAction("USB Camera info", this);
     configMenu->addAction(cameraInfoAction);  
+    textDetectionAction = new QAction("Text detection", this);
+    configMenu->addAction(textDetectionAction);
+    camerasAction = new QAction("Cameras", this);
+    configMenu->addAction(camerasAction);
+    regionsOfInterestAction = new QAction("Regions of interest", this);
+    configMenu->addAction(regionsOfInterestAction);
+    motionZonesAction = new QAction("Motion zones", this);
+    configMenu->addAction(motionZonesAction);
+    saveDetectorOutputsAction = new QAction("Save EAST outputs", this);
+    configMenu->addAction(saveDetectorOutputsAction);
+    benchmarkDecodeAction = new QAction("Benchmark EAST decode", this);
+    configMenu->addAction(benchmarkDecodeAction);
     OCRUSBcamera = new QAction("OCR", this);
     videoUSBMenu->addAction(OCRUSBcamera);
-    calcFPSAction = new QAction("FPS", this);
+    calcFPSAction = new QAction("FPS and latencies", this);
     videoUSBMenu->addAction(calcFPSAction);
     NectaCamera = new QAction("&Necta Camera", this);
     videoMenu->addAction(NectaCamera);
     OakDCamera = new QAction("&OAK-D Camera", this);
     videoMenu->addAction(OakDCamera);
+    videoFileAction = new QAction("Video &file", this);
+    videoMenu->addAction(videoFileAction);
+    QSettings settings;
+    replayPacedAction = new QAction("Real time", this);
+    replayPacedAction->setCheckable(true);
+    replayPacedAction->setChecked(settings.value("replay/paced", true).toBool());
+    replayMenu->addAction(replayPacedAction);
+    replayLoopAction = new QAction("Loop", this);
+    replayLoopAction->setCheckable(true);
+    replayLoopAction->setChecked(settings.value("replay/loop", false).toBool());
+    replayMenu->addAction(replayLoopAction);
+    seekAction = new QAction("Seek...", this);
+    replayMenu->addAction(seekAction);
+    testPatternAction = new QAction("&Test pattern", this);
+    videoMenu->addAction(testPatternAction);
+    recordMotionAction = new QAction("&Record on motion", this);
+    recordMotionAction->setCheckable(true);
+    videoMenu->addAction(recordMotionAction);
     aboutAction = new QAction("About", this);
     helpMenu->addAction(aboutAction);
 
@@ -139,11 +204,24 @@ void MainWindow::createActions()
     connect(zoomInAction, SIGNAL(triggered(bool)), this, SLOT(zoomIn()));
     connect(zoomOutAction, SIGNAL(triggered(bool)), this, SLOT(zoomOut()));
     connect(cameraInfoAction, SIGNAL(triggered(bool)), this, SLOT(showCameraInfo()));
+    connect(textDetectionAction, SIGNAL(triggered(bool)), this, SLOT(configureTextDetection()));
+    connect(camerasAction, SIGNAL(triggered(bool)), this, SLOT(configureCameras()));
+    connect(regionsOfInterestAction, SIGNAL(triggered(bool)), this, SLOT(selectRegionsOfInterest()));
+    connect(motionZonesAction, SIGNAL(triggered(bool)), this, SLOT(selectMotionZones()));
+    connect(saveDetectorOutputsAction, SIGNAL(triggered(bool)), this, SLOT(saveDetectorOutputs()));
+    connect(benchmarkDecodeAction, SIGNAL(triggered(bool)), this, SLOT(benchmarkDecode()));
     connect(OCRUSBcamera, SIGNAL(triggered(bool)), this, SLOT(openOCRUSBCamera()));
-    //connect(calcFPSAction, SIGNAL(triggered(bool)), this, SLOT(calculateFPS()));
+    connect(calcFPSAction, SIGNAL(triggered(bool)), this, SLOT(showTelemetry()));
     connect(NectaCamera, SIGNAL(triggered(bool)), this, SLOT(openNectaCamera()));
     connect(OakDCamera, SIGNAL(triggered(bool)), this, SLOT(openOakDCamera()));
+    connect(videoFileAction, SIGNAL(triggered(bool)), this, SLOT(openVideoFile()));
+    connect(replayPacedAction, SIGNAL(triggered(bool)), this, SLOT(setReplayOptions()));
+    connect(replayLoopAction, SIGNAL(triggered(bool)), this, SLOT(setReplayOptions()));
+    connect(seekAction, SIGNAL(triggered(bool)), this, SLOT(seekVideoFile()));
+    connect(recordMotionAction, SIGNAL(toggled(bool)), this, SLOT(setMotionRecording(bool)));
+    connect(testPatternAction, SIGNAL(triggered(bool)), this, SLOT(openTestPattern()));
     connect(aboutAction, SIGNAL(triggered(bool)), this, SLOT(aboutDialog()));
+    connect(displayTimer, SIGNAL(timeout()), this, SLOT(refreshDisplay()));
     setupShortcuts();
 }
 
@@ -163,7 +241,8 @@ void MainWindow::openImage()
 
 void MainWindow::showImage(QPixmap image)
 {
-    imageScene->clear();
+    viewStack->setCurrentWidget(imageView);
+    clearScene();
     imageView->resetMatrix();
     currentImage = imageScene->addPixmap(image);
     imageScene->update();
@@ -182,24 +261,42 @@ void MainWindow::showImage(QString path)
 
 void MainWindow::showImage(cv::Mat mat)
 {
+    // mat is BGR, like the frames of the cameras
     QImage image(
         mat.data,
         mat.cols,
         mat.rows,
         mat.step,
         QImage::Format_RGB888);
+    showImage(QPixmap::fromImage(image.rgbSwapped()));
+}
 
-    QPixmap pixmap = QPixmap::fromImage(image);
-    imageScene->clear();
-    imageView->resetMatrix();
-    currentImage = imageScene->addPixmap(pixmap);
-    imageScene->update();
-    imageView->setSceneRect(pixmap.rect());
+QPixmap MainWindow::currentPixmap(int camera) const
+{
+    if(viewStack->currentWidget() == videoWidget) {
+        return QPixmap::fromImage(videoWidget->snapshot(camera));
+    }
+    return currentImage != nullptr ? currentImage->pixmap() : QPixmap();
+}
+
+int MainWindow::selectCamera(const QString &title)
+{
+    if(viewStack->currentWidget() != videoWidget || videoWidget->tileCount() <= 1) {
+        return 0;
+    }
+    QStringList cameras;
+    for(int i = 0; i < videoWidget->tileCount(); i++) {
+        cameras.append(QString("Camera %1").arg(i + 1));
+    }
+    bool ok;
+    QString camera = QInputDialog::getItem(this, title, "Camera", cameras, 0, false, &ok);
+    return ok ? cameras.indexOf(camera) : -1;
 }
 
 void MainWindow::saveImageAs()
 {
-    if (currentImage == nullptr) {
+    QPixmap pixmap = currentPixmap();
+    if (pixmap.isNull()) {
         QMessageBox::information(this, "Information", "Nothing to save.");
         return;
     }
@@ -212,7 +309,7 @@ void MainWindow::saveImageAs()
     if (dialog.exec()) {
         fileNames = dialog.selectedFiles();
         if(QRegExp(".+\\.(png|bmp|jpg)").exactMatch(fileNames.at(0))) {
-            currentImage->pixmap().save(fileNames.at(0));
+            pixmap.save(fileNames.at(0));
         } else {
             QMessageBox::information(this, "Error", "Save error: Bad format or file.");
         }
@@ -256,7 +353,8 @@ void MainWindow::setupShortcuts()
 
 void MainWindow::extractText()
 {
-    if (currentImage == nullptr) {
+    QPixmap pixmap = currentPixmap();
+    if (pixmap.isNull()) {
         QMessageBox::information(this, "Information", "Image not opened.");
         return;
     }
@@ -272,25 +370,36 @@ void MainWindow::extractText()
         }
     }
 
-    QPixmap pixmap = currentImage->pixmap();
     QImage image = pixmap.toImage();
     image = image.convertToFormat(QImage::Format_RGB888);
-
-    tesseractAPI->SetImage(image.bits(), image.width(), image.height(),
-        3, image.bytesPerLine());
+    // the detector and Tesseract take BGR, like the frames of the cameras
+    cv::Mat frame;
+    cv::cvtColor(cv::Mat(image.height(), image.width(), CV_8UC3, image.bits(), image.bytesPerLine()),
+                 frame, cv::COLOR_RGB2BGR);
+    std::vector<cv::Rect> regions =
+        TextDetector::clipRegions(Utilities::loadRegionsOfInterest(), frame.size());
+    if(tesseractPool == nullptr) {
+        tesseractPool = new TesseractPool();
+    }
 
     if (detectAreaCheckBox->checkState() == Qt::Checked) {
         std::vector<cv::Rect> areas;
-        cv::Mat newImage = detectTextAreas(image, areas);
+        detectorLoading.waitForFinished();
+        detector.detect(frame, regions, areas);
+        const TextDetector::Timings &timings = detector.lastTimings();
+        mainStatusLabel->setText(
+            QString("EAST: preprocess %1 ms, inference %2 ms, decode %3 ms, NMS %4 ms")
+            .arg(timings.preprocess_ms, 0, 'f', 1).arg(timings.inference_ms, 0, 'f', 1)
+            .arg(timings.decode_ms, 0, 'f', 1).arg(timings.nms_ms, 0, 'f', 1));
+        TesseractPool::sortReadingOrder(areas);
+        cv::Mat newImage = frame.clone();
+        TextDetector::drawAreas(newImage, areas);
         showImage(newImage);
-        editor->setPlainText("");
-        for(cv::Rect &rect : areas) {
-            tesseractAPI->SetRectangle(rect.x, rect.y, rect.width, rect.height);
-            char *outText = tesseractAPI->GetUTF8Text();
-            editor->setPlainText(editor->toPlainText() + outText);
-            delete [] outText;
-        }
+        editor->setPlainText(tesseractPool->recognizeAreas(frame, areas));
+    } else if (!regions.empty()) {
+        editor->setPlainText(tesseractPool->recognizeAreas(frame, regions));
     } else {
+        TesseractPool::setImage(tesseractAPI, frame, cv::Rect(0, 0, frame.cols, frame.rows));
         char *outText = tesseractAPI->GetUTF8Text();
         editor->setPlainText(outText);
         delete [] outText;
@@ -300,115 +409,165 @@ void MainWindow::extractText()
     free(old_ctype);
 }
 
-cv::Mat MainWindow::detectTextAreas(QImage &image, std::vector<cv::Rect> &areas)
+void MainWindow::configureTextDetection()
 {
-    float confThreshold = 0.5;
-    float nmsThreshold = 0.4;
-    int inputWidth = 320;
-    int inputHeight = 320;
-    std::string model = "./frozen_east_text_detection.pb";
-    // Load DNN network.
-    if (net.empty()) {
-        net = cv::dnn::readNet(model);
+    TextDetector::Config config = TextDetector::Config::fromSettings();
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Text detection");
+    QFormLayout *form = new QFormLayout(&dialog);
+    QSpinBox *widthBox = new QSpinBox(&dialog);
+    widthBox->setRange(32, 4096);
+    widthBox->setSingleStep(32);
+    widthBox->setValue(config.input_width);
+    form->addRow("Input width", widthBox);
+    QSpinBox *heightBox = new QSpinBox(&dialog);
+    heightBox->setRange(32, 4096);
+    heightBox->setSingleStep(32);
+    heightBox->setValue(config.input_height);
+    form->addRow("Input height", heightBox);
+    QCheckBox *tiledBox = new QCheckBox("Split large frames into tiles", &dialog);
+    tiledBox->setChecked(config.tiled);
+    form->addRow(tiledBox);
+    QSpinBox *overlapBox = new QSpinBox(&dialog);
+    overlapBox->setRange(0, 2048);
+    overlapBox->setValue(config.tile_overlap);
+    form->addRow("Tile overlap", overlapBox);
+    QDialogButtonBox *buttons = new QDialogButtonBox(
+        QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    form->addRow(buttons);
+    if (!dialog.exec()) {
+        return;
     }
 
-    std::vector<cv::Mat> outs;
-    std::vector<std::string> layerNames(2);
-    layerNames[0] = "feature_fusion/Conv_7/Sigmoid";
-    layerNames[1] = "feature_fusion/concat_3";
+    config.input_width = widthBox->value();
+    config.input_height = heightBox->value();
+    config.tiled = tiledBox->isChecked();
+    config.tile_overlap = overlapBox->value();
+    detectorLoading.waitForFinished();
+    detector.setConfig(config);
+    // save the rounded values
+    detector.currentConfig().save();
+    for(CapturePipeline *pipeline : pipelines) {
+        pipeline->ocr()->setDetectorConfig(detector.currentConfig());
+    }
+}
 
-    cv::Mat frame = cv::Mat(
-        image.height(),
-        image.width(),
-        CV_8UC3,
-        image.bits(),
-        image.bytesPerLine()).clone();
-    cv::Mat blob;
-
-    cv::dnn::blobFromImage(
-        frame, blob,
-        1.0, cv::Size(inputWidth, inputHeight),
-        cv::Scalar(123.68, 116.78, 103.94), true, false
-    );
-    net.setInput(blob);
-    net.forward(outs, layerNames);
-
-    cv::Mat scores = outs[0];
-    cv::Mat geometry = outs[1];
-
-    std::vector<cv::RotatedRect> boxes;
-    std::vector<float> confidences;
-    decode(scores, geometry, confThreshold, boxes, confidences);
-
-    std::vector<int> indices;
-    cv::dnn::NMSBoxes(boxes, confidences, confThreshold, nmsThreshold, indices);
-
-    // Render detections.
-    cv::Point2f ratio((float)frame.cols / inputWidth, (float)frame.rows / inputHeight);
-    cv::Scalar green = cv::Scalar(0, 255, 0);
-
-    for (size_t i = 0; i < indices.size(); ++i) {
-        cv::RotatedRect& box = boxes[indices[i]];
-        cv::Rect area = box.boundingRect();
-        area.x *= ratio.x;
-        area.width *= ratio.x;
-        area.y *= ratio.y;
-        area.height *= ratio.y;
-        areas.push_back(area);
-        cv::rectangle(frame, area, green, 1);
-        QString index = QString("%1").arg(i);
-        cv::putText(
-            frame, index.toStdString(), cv::Point2f(area.x, area.y - 2),
-            cv::FONT_HERSHEY_SIMPLEX, 0.5, green, 1
-        );
-    }
-    return frame;
-}
-
-void MainWindow::decode(const cv::Mat& scores, const cv::Mat& geometry, float scoreThresh,
-    std::vector<cv::RotatedRect>& detections, std::vector<float>& confidences)
-{
-    CV_Assert(scores.dims == 4); CV_Assert(geometry.dims == 4);
-    CV_Assert(scores.size[0] == 1); CV_Assert(scores.size[1] == 1);
-    CV_Assert(geometry.size[0] == 1);  CV_Assert(geometry.size[1] == 5);
-    CV_Assert(scores.size[2] == geometry.size[2]);
-    CV_Assert(scores.size[3] == geometry.size[3]);
-
-    detections.clear();
-    const int height = scores.size[2];
-    const int width = scores.size[3];
-    for (int y = 0; y < height; ++y) {
-        const float* scoresData = scores.ptr<float>(0, 0, y);
-        const float* x0_data = geometry.ptr<float>(0, 0, y);
-        const float* x1_data = geometry.ptr<float>(0, 1, y);
-        const float* x2_data = geometry.ptr<float>(0, 2, y);
-        const float* x3_data = geometry.ptr<float>(0, 3, y);
-        const float* anglesData = geometry.ptr<float>(0, 4, y);
-        for (int x = 0; x < width; ++x) {
-            float score = scoresData[x];
-            if (score < scoreThresh)
-                continue;
-
-            // Decode a prediction.
-            // Multiple by 4 because feature maps are 4 time less than input image.
-            float offsetX = x * 4.0f, offsetY = y * 4.0f;
-            float angle = anglesData[x];
-            float cosA = std::cos(angle);
-            float sinA = std::sin(angle);
-            float h = x0_data[x] + x2_data[x];
-            float w = x1_data[x] + x3_data[x];
-
-            cv::Point2f offset(offsetX + cosA * x1_data[x] + sinA * x2_data[x],
-                offsetY - sinA * x1_data[x] + cosA * x2_data[x]);
-            cv::Point2f p1 = cv::Point2f(-sinA * h, -cosA * h) + offset;
-            cv::Point2f p3 = cv::Point2f(-cosA * w, sinA * w) + offset;
-            cv::RotatedRect r(0.5f * (p1 + p3), cv::Size2f(w, h), -angle * 180.0f / (float)CV_PI);
-            detections.push_back(r);
-            confidences.push_back(score);
+void MainWindow::selectRegionsOfInterest()
+{
+    int camera = selectCamera("Regions of interest");
+    if(camera < 0) {
+        return;
+    }
+    QPixmap pixmap = currentPixmap(camera);
+    if (pixmap.isNull()) {
+        QMessageBox::information(this, "Information", "Open an image or a camera first.");
+        return;
+    }
+    RoiSelector *selector = new RoiSelector(pixmap, Utilities::loadRegionsOfInterest(camera), this);
+    connect(selector, &RoiSelector::regionsSelected, this, [this, camera](QList<QRect> regions) {
+        setRegionsOfInterest(camera, regions);
+    });
+    selector->show();
+    selector->activateWindow();
+}
+
+void MainWindow::setRegionsOfInterest(int camera, QList<QRect> regions)
+{
+    Utilities::saveRegionsOfInterest(regions, camera);
+    videoWidget->setRegions(camera, regions);
+    if(camera < pipelines.size()) {
+        pipelines[camera]->ocr()->setRegionsOfInterest(regions);
+    }
+    mainStatusLabel->setText(QString("%1 regions of interest").arg(regions.size()));
+}
+
+void MainWindow::selectMotionZones()
+{
+    int camera = selectCamera("Motion zones");
+    if(camera < 0) {
+        return;
+    }
+    QPixmap pixmap = currentPixmap(camera);
+    if (pixmap.isNull()) {
+        QMessageBox::information(this, "Information", "Open an image or a camera first.");
+        return;
+    }
+    QList<QRect> areas;
+    for(const MotionZone &zone : MotionDetector::Config::fromSettings(camera).zones) {
+        if(!zone.area.isNull()) {
+            areas.append(zone.area);
+        }
+    }
+    RoiSelector *selector = new RoiSelector(pixmap, areas, this);
+    connect(selector, &RoiSelector::regionsSelected, this, [this, camera](QList<QRect> areas) {
+        setMotionZones(camera, areas);
+    });
+    selector->show();
+    selector->activateWindow();
+}
+
+void MainWindow::setMotionZones(int camera, QList<QRect> areas)
+{
+    // zones drawn again keep their name, thresholds and actions, new ones
+    // get those of the whole frame
+    MotionDetector::Config config = MotionDetector::Config::fromSettings(camera);
+    QVector<MotionZone> zones;
+    for(const QRect &area : areas) {
+        MotionZone zone = MotionDetector::Config::defaultZone(config.min_area);
+        zone.name = QString("zone %1").arg(zones.size() + 1);
+        zone.area = area;
+        for(const MotionZone &existing : config.zones) {
+            if(existing.area == area) {
+                zone = existing;
+            }
+        }
+        zones.append(zone);
+    }
+    config.zones = zones;
+    config.save(camera);
+    mainStatusLabel->setText(zones.isEmpty()
+        ? QString("Motion is detected in the whole frame from the next capture")
+        : QString("%1 motion zones from the next capture").arg(zones.size()));
+}
+
+void MainWindow::saveDetectorOutputs()
+{
+    QFileDialog dialog(this);
+    dialog.setWindowTitle("Save EAST outputs as ...");
+    dialog.setFileMode(QFileDialog::AnyFile);
+    dialog.setAcceptMode(QFileDialog::AcceptSave);
+    dialog.setNameFilter(tr("OpenCV storage (*.yml.gz *.yml)"));
+    QStringList fileNames;
+    if (dialog.exec()) {
+        fileNames = dialog.selectedFiles();
+        if(!detector.saveOutputs(fileNames.at(0).toStdString())) {
+            QMessageBox::information(this, "Error", "Run OCR with Detect Text Areas checked first.");
         }
     }
 }
 
+void MainWindow::benchmarkDecode()
+{
+    QFileDialog dialog(this);
+    dialog.setWindowTitle("Open EAST outputs");
+    dialog.setFileMode(QFileDialog::ExistingFile);
+    dialog.setNameFilter(tr("OpenCV storage (*.yml.gz *.yml)"));
+    QStringList filePaths;
+    if (dialog.exec()) {
+        filePaths = dialog.selectedFiles();
+        cv::Mat scores, geometry;
+        if(!TextDetector::loadOutputs(filePaths.at(0).toStdString(), scores, geometry)) {
+            QMessageBox::information(this, "Error", "No EAST outputs in this file.");
+            return;
+        }
+        TextDetector bench;
+        QMessageBox::information(this, "EAST decode benchmark", bench.benchmarkDecode(scores, geometry));
+    }
+}
+
 void MainWindow::captureScreen()
 {
     this->setWindowState(this->windowState() | Qt::WindowMinimized);
@@ -445,129 +604,329 @@ void MainWindow::showCameraInfo()
 
 void MainWindow::openOCRUSBCamera()
 {
-    /*if(capturer != nullptr) {
-        // if a thread is already running, stop it
-        capturer->setRunning(false);
-        disconnect(capturer, &USBCaptureThread::frameCaptured, this, &MainWindow::updateFrame);
-        connect(capturer, &USBCaptureThread::finished, capturer, &USBCaptureThread::deleteLater);
-    }*/
-    // I am using my second camera whose Index is 2.  Usually, the
-    // Index of the first camera is 0.
-    int camID = 0;
-    capturer = new USBCaptureThread(camID, data_lock);
-    connect(capturer, &USBCaptureThread::frameCaptured, this, &MainWindow::updateFrame);
-    capturer->start();
-    mainStatusLabel->setText(QString("Capturing Camera %1").arg(camID));
+    // every configured camera gets its own pipeline, see configureCameras()
+    CapturePipeline::Config config = CapturePipeline::Config::fromSettings();
+    QList<FrameSource*> sources;
+    for(int camID : config.cameras) {
+        sources.append(new UsbFrameSource(camID));
+    }
+    openPipelines(sources, config);
 }
 
-void MainWindow::openNectaCamera()
+void MainWindow::openVideoFile()
 {
-    int camID = 0;
-    nectacapturer = new NectaCaptureThread(camID, data_lock);
-    connect(nectacapturer, &NectaCaptureThread::nectaframeCaptured, this, &MainWindow::updateFrameNecta);
-    nectacapturer->start();
-    mainStatusLabel->setText(QString("Capturing Necta Camera"));
-            //QPixmap image = QPixmap("/home/javi/prueba.bmp");
-            //QPixmap image = QPixmap("/home/javi/prueba.bmp", "BMP",Qt::NoFormatConversion);
-            //QPixmap image = QPixmap::fromImage(imageq,Qt::MonoOnly);
-            //QPixmap image = QPixmap("/home/javi/prueba.bmp", "BMP",Qt::MonoOnly);
-            //sleep(10);
-            //CAlkUSB3::INectaCamera::Destroy(*myCam);
- }
+    QString path = QFileDialog::getOpenFileName(this, "Open Video", QDir::homePath(),
+                                                tr("Videos (*.avi *.mp4 *.mkv *.mov *.idx *.mjpg)"));
+    if(path.isEmpty()) {
+        return;
+    }
+    // real time to reproduce what the cameras see, or as fast as possible
+    // to measure the throughput of the whole pipeline
+    VideoFileFrameSource::Pacing pacing = replayPacedAction->isChecked()
+        ? VideoFileFrameSource::PACED : VideoFileFrameSource::UNTHROTTLED;
+    CapturePipeline::Config config;
+    config.pin_threads = false;
+    config.every_frame = pacing == VideoFileFrameSource::UNTHROTTLED;
+    openPipelines({new VideoFileFrameSource(path, pacing, replayLoopAction->isChecked())}, config);
+}
 
+void MainWindow::setReplayOptions()
+{
+    // applied to the next file opened
+    QSettings settings;
+    settings.setValue("replay/paced", replayPacedAction->isChecked());
+    settings.setValue("replay/loop", replayLoopAction->isChecked());
+}
 
-void MainWindow::openOakDCamera()
+void MainWindow::seekVideoFile()
 {
-    int camID = 0;
-    oakdcapturer = new OakdCaptureThread(camID, data_lock);
-    oakdcapturer->start();
-    mainStatusLabel->setText(QString("Capturing OAK-D Camera"));
+    VideoFileFrameSource *file = nullptr;
+    if(pipelines.size() == 1) {
+        file = dynamic_cast<VideoFileFrameSource*>(pipelines.first()->engine()->frameSource());
+    }
+    if(file == nullptr) {
+        QMessageBox::information(this, "Information", "No video file is being played.");
+        return;
+    }
+    bool ok;
+    double seconds = QInputDialog::getDouble(this, "Seek", "Position (s)", file->position(),
+                                             0, qMax(file->duration(), 0.0), 1, &ok);
+    if(ok) {
+        file->seek(seconds);
+    }
 }
 
-void MainWindow::updateFrame(cv::Mat *mat)
+void MainWindow::openTestPattern()
 {
-    data_lock->lock();
-    currentFrame = *mat;
-    data_lock->unlock();
+    CapturePipeline::Config config;
+    config.pin_threads = false;
+    openPipelines({new SyntheticFrameSource()}, config);
+}
 
-    QImage frame(
-        currentFrame.data,
-        currentFrame.cols,
-        currentFrame.rows,
-        currentFrame.step,
-        QImage::Format_RGB888);
-    //3 lines added for OCR Video
-    QImage ocrframe;
-    ocrframe=extractTextVideo(frame);
-    QPixmap image = QPixmap::fromImage(ocrframe);
-    imageScene->clear();
-    imageView->resetMatrix();
-    imageScene->addPixmap(image);
-    imageScene->update();
-    imageView->setSceneRect(image.rect());
+void MainWindow::openPipelines(QList<FrameSource*> sources, const CapturePipeline::Config &config)
+{
+    // if pipelines are already running, stop them
+    stopPipelines();
+    for(int i = 0; i < sources.size(); i++) {
+        CapturePipeline *pipeline = new CapturePipeline(
+            i, sources[i], config.cameras.value(i, i), config.cpusFor(i),
+            config.workersFor(i), config.every_frame, this);
+        pipeline->engine()->setEventDispatcher(eventDispatcher);
+        connect(pipeline, &CapturePipeline::textRecognized, this, &MainWindow::showRecognizedText);
+        connect(pipeline->engine(), &CaptureEngine::videoSaved, this, &MainWindow::showSavedVideo);
+        pipeline->engine()->setMotionDetectingStatus(recordMotionAction->isChecked());
+        pipelines.append(pipeline);
+        views.append(CameraView{0, QVector<QRect>(), QString()});
+    }
+    videoWidget->setTileCount(pipelines.size());
+    for(int i = 0; i < pipelines.size(); i++) {
+        videoWidget->setMetrics(i, pipelines[i]->engine()->metrics());
+        videoWidget->setRegions(i, Utilities::loadRegionsOfInterest(i));
+    }
+    viewStack->setCurrentWidget(videoWidget);
+    if(!pipelines.isEmpty() && !pipelines.first()->ocr()->isReady()) {
+        QMessageBox::information(this, "Error", "Tesseract could not be initialized.");
+    }
+    for(CapturePipeline *pipeline : pipelines) {
+        pipeline->start();
+    }
+    startDisplay();
+    if(sources.size() == 1) {
+        mainStatusLabel->setText(QString("Capturing %1").arg(sources.first()->name()));
+    } else {
+        mainStatusLabel->setText(QString("Capturing %1 cameras").arg(sources.size()));
+    }
+}
+
+void MainWindow::setMotionRecording(bool enabled)
+{
+    for(CapturePipeline *pipeline : pipelines) {
+        pipeline->engine()->setMotionDetectingStatus(enabled);
+    }
+}
+
+void MainWindow::showSavedVideo(QString name)
+{
+    CaptureEngine *engine = qobject_cast<CaptureEngine*>(sender());
+    QString status = QString("Saved %1 in %2").arg(name).arg(Utilities::getDataPath());
+    if(engine != nullptr) {
+        status += QString(" (%1)").arg(engine->videoRecorder()->statistics());
+    }
+    mainStatusLabel->setText(status);
 }
 
-void MainWindow::updateFrameNecta()
+void MainWindow::stopPipelines()
+{
+    // the view holds frames of the rings
+    if(!pipelines.isEmpty()) {
+        displayTimer->stop();
+        videoWidget->clear();
+        telemetryLabel->clear();
+    }
+    qDeleteAll(pipelines);
+    pipelines.clear();
+    views.clear();
+}
+
+void MainWindow::clearScene()
 {
-    data_lock->lock();
-    //sleep(0.1);
-    QImage imageq = QImage("/home/javi/prueba.bmp");
-    data_lock->unlock();
-    QPixmap image = QPixmap::fromImage(imageq);
     imageScene->clear();
-    imageView->resetMatrix();
-    imageScene->addPixmap(image);
-    imageScene->update();
-    imageView->setSceneRect(image.rect());
+    currentImage = nullptr;
 }
-QImage MainWindow::extractTextVideo(QImage frame)
+
+void MainWindow::configureCameras()
 {
-    QImage image;
-    char *old_ctype = strdup(setlocale(LC_ALL, NULL));
-    setlocale(LC_ALL, "C");
-    if (tesseractAPI == nullptr) {
-        tesseractAPI = new tesseract::TessBaseAPI();
-        // Initialize tesseract-ocr with English, with specifying tessdata path
-        if (tesseractAPI->Init(TESSDATA_PREFIX, "eng")) {
-            QMessageBox::information(this, "Error", "Tesseract could not be initialized.");
-            return(frame);
+    CapturePipeline::Config config = CapturePipeline::Config::fromSettings();
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Cameras");
+    QFormLayout *form = new QFormLayout(&dialog);
+    QStringList ids, cpus;
+    for(int camera : config.cameras) {
+        ids.append(QString::number(camera));
+    }
+    for(const QList<int> &set : config.cpus) {
+        cpus.append(CapturePipeline::Config::formatCpus(set));
+    }
+    QLineEdit *camerasEdit = new QLineEdit(ids.join(", "), &dialog);
+    form->addRow("USB camera indices", camerasEdit);
+    QCheckBox *pinBox = new QCheckBox("Pin each camera to its own cores", &dialog);
+    pinBox->setChecked(config.pin_threads);
+    form->addRow(pinBox);
+    QLineEdit *cpusEdit = new QLineEdit(cpus.join("; "), &dialog);
+    cpusEdit->setPlaceholderText(QString("automatic, e.g. 0-1; 2-3"));
+    form->addRow("Cores per camera", cpusEdit);
+    QCheckBox *shmBox = new QCheckBox("Publish frames in shared memory (/hsk_vision.N)", &dialog);
+    shmBox->setChecked(QSettings().value("shm/publish", false).toBool());
+    form->addRow(shmBox);
+    QDialogButtonBox *buttons = new QDialogButtonBox(
+        QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    form->addRow(buttons);
+    if (!dialog.exec()) {
+        return;
+    }
+
+    config.cameras.clear();
+    for(const QString &id : camerasEdit->text().split(',', QString::SkipEmptyParts)) {
+        bool ok;
+        int camera = id.trimmed().toInt(&ok);
+        if(ok) {
+            config.cameras.append(camera);
         }
     }
-    image = frame;
+    if(config.cameras.isEmpty()) {
+        config.cameras.append(0);
+    }
+    config.pin_threads = pinBox->isChecked();
+    config.cpus.clear();
+    for(const QString &set : cpusEdit->text().split(';', QString::SkipEmptyParts)) {
+        config.cpus.append(CapturePipeline::Config::parseCpus(set));
+    }
+    config.save();
+    QSettings().setValue("shm/publish", shmBox->isChecked());
+}
 
-    tesseractAPI->SetImage(image.bits(), image.width(), image.height(),
-        3, image.bytesPerLine());
+void MainWindow::openNectaCamera()
+{
+    // frames go through the same pipeline as the USB cameras, with its
+    // motion recording, notifications and OCR
+    int camID = 0;
+    FrameSource *source;
+    if(qEnvironmentVariableIsSet("HSK_NECTA_SIMULATOR")) {
+        source = AlkeriaNectaSource::simulator();
+    } else {
+        source = new AlkeriaNectaSource(camID);
+    }
+    CapturePipeline::Config config;
+    config.cameras = {camID};
+    config.pin_threads = false;
+    openPipelines({source}, config);
+}
 
-    if (detectAreaCheckBox->checkState() == Qt::Checked) {
-        std::vector<cv::Rect> areas;
-        cv::Mat newImage = detectTextAreas(image, areas);
-        //showImage(newImage);
-        editor->setPlainText("");
-        for(cv::Rect &rect : areas) {
-            tesseractAPI->SetRectangle(rect.x, rect.y, rect.width, rect.height);
-            char *outText = tesseractAPI->GetUTF8Text();
-            editor->setPlainText(editor->toPlainText() + outText);
-            delete [] outText;
-        }
-        QImage returnedImage(
-            newImage.data,
-            newImage.cols,
-            newImage.rows,
-            newImage.step,
-            QImage::Format_RGB888);
-        setlocale(LC_ALL, old_ctype);
-        free(old_ctype);
-        return(returnedImage);
+void MainWindow::openOakDCamera()
+{
+    // frames go through the same pipeline as the USB cameras
+    int camID = 0;
+    CapturePipeline::Config config;
+    config.cameras = {camID};
+    config.pin_threads = false;
+    openPipelines({new OakdFrameSource(camID)}, config);
+}
+
+void MainWindow::startDisplay()
+{
+    telemetry.clear();
+    for(CaptureEngine *engine : liveEngines()) {
+        telemetry.append(engine->metrics()->snapshot());
+    }
+    telemetryTime.start();
+    displayTimer->start();
+}
+
+QList<CaptureEngine*> MainWindow::liveEngines() const
+{
+    QList<CaptureEngine*> engines;
+    for(CapturePipeline *pipeline : pipelines) {
+        engines.append(pipeline->engine());
+    }
+    return engines;
+}
 
+void MainWindow::refreshDisplay()
+{
+    for(int i = 0; i < pipelines.size(); i++) {
+        updateFrame(i);
+    }
+    // rates over the last second, the counters are never reset
+    if(telemetryTime.elapsed() < 1000) {
+        return;
+    }
+    telemetryTime.restart();
+    QList<CaptureEngine*> engines = liveEngines();
+    QStringList texts;
+    for(int i = 0; i < engines.size() && i < telemetry.size(); i++) {
+        PipelineMetrics::Snapshot current = engines[i]->metrics()->snapshot();
+        QString text = PipelineMetrics::summary(current.since(telemetry[i]));
+        telemetry[i] = current;
+        texts.append(engines.size() == 1 ? text
+                     : QString("%1: %2").arg(engines[i]->frameSource()->name()).arg(text));
+    }
+    telemetryLabel->setText(texts.join(" | "));
+}
+
+void MainWindow::showTelemetry()
+{
+    QList<CaptureEngine*> engines = liveEngines();
+    if(engines.isEmpty()) {
+        QMessageBox::information(this, "Information", "No camera is capturing.");
+        return;
+    }
+    QStringList reports;
+    for(CaptureEngine *engine : engines) {
+        reports.append(QString("%1\n%2").arg(engine->frameSource()->name())
+                       .arg(PipelineMetrics::report(engine->metrics()->snapshot())));
+    }
+    qDebug().noquote() << reports.join("\n\n");
+    QMessageBox::information(this, "FPS and latencies", reports.join("\n\n"));
+}
+
+void MainWindow::updateFrame(int index)
+{
+    if(index >= pipelines.size()) {
+        return;
+    }
+    // called once per screen refresh: frames captured in between are
+    // skipped, the slot of the frame shown here is returned to the ring
+    // once OCR and the display are done with it
+    FrameRing *ring = pipelines[index]->engine()->frames();
+    bool detect_areas = detectAreaCheckBox->checkState() == Qt::Checked;
+    FrameRef captured;
+    if(pipelines[index]->everyFrame()) {
+        // a benchmark: OCR gets every frame in order, only the newest is shown
+        for(FrameRef next = ring->read(); !next.isNull(); next = ring->read()) {
+            pipelines[index]->ocr()->submit(next, detect_areas);
+            captured = std::move(next);
+        }
     } else {
-        char *outText = tesseractAPI->GetUTF8Text();
-        editor->setPlainText(outText);
-        delete [] outText;
+        captured = ring->readLatest();
+        if(!captured.isNull()) {
+            pipelines[index]->ocr()->submit(captured, detect_areas);
+        }
+    }
+    if(captured.isNull()) {
+        return;
     }
+    videoWidget->setFrame(index, captured);
+    CaptureEngine::MotionOverlay overlay = pipelines[index]->engine()->motionOverlay();
+    videoWidget->setMotion(index, overlay.zones, overlay.active, overlay.boxes);
+}
 
-    setlocale(LC_ALL, old_ctype);
-    free(old_ctype);
-    return(frame);
+void MainWindow::showRecognizedText(int index, quint64 sequence, QString text, QVector<QRect> areas)
+{
+    if(index >= views.size()) {
+        return;
+    }
+    // workers finish out of order, never go back to an older frame
+    CameraView &view = views[index];
+    if(sequence < view.sequence) {
+        return;
+    }
+    view.sequence = sequence;
+    view.areas = areas;
+    view.text = text;
+    videoWidget->setAreas(index, areas);
+    if(views.size() == 1) {
+        editor->setPlainText(text);
+        return;
+    }
+    QStringList texts;
+    for(int i = 0; i < views.size(); i++) {
+        texts.append(QString("[%1]\n%2").arg(pipelines[i]->engine()->frameSource()->name())
+                     .arg(views[i].text));
+    }
+    editor->setPlainText(texts.join("\n"));
 }
 
 void MainWindow::aboutDialog()
@@ -576,11 +935,11 @@ void MainWindow::aboutDialog()
 }
 void MainWindow::extractDimensions()
 {
-    if (currentImage == nullptr) {
+    QPixmap imagePix = currentPixmap();
+    if (imagePix.isNull()) {
         QMessageBox::information(this, "Information", "Image not opened.");
         return;
     }
-    QPixmap imagePix = currentImage->pixmap();
     QImage imageQIm = imagePix.toImage();
     cv::Mat mat = cv::Mat(
         imageQIm.height(),
@@ -25,8 +25,10 @@
 #include <QCameraViewfinder>
 #include <QListView>
 #include <QPushButton>
-#include <QMutex>
 #include <QStandardItemModel>
+#include <QFuture>
+#include <QStackedWidget>
+#include <QElapsedTimer>
 
 
 
@@ -38,9 +40,15 @@
 #include "opencv2/highgui.hpp"
 #include "opencv2/imgproc.hpp"
 #include <iostream>
+#include "capture_engine.h"
+#include "capture_pipeline.h"
 #include "usb_camera.h"
 #include "necta_camera.h"
 #include "oakd_camera.h"
+#include "text_detector.h"
+#include "tesseract_pool.h"
+#include "ocr_worker.h"
+#include "video_widget.h"
 
 class MainWindow : public QMainWindow
 {
@@ -50,7 +58,6 @@ public:
     explicit MainWindow(QWidget *parent=nullptr);
     ~MainWindow();
     void showImage(QPixmap);
-    QImage extractTextVideo(QImage frame);
 
 private:
     void initUI();
@@ -58,10 +65,17 @@ private:
     void showImage(QString);
     void showImage(cv::Mat);
     void setupShortcuts();
-
-    void decode(const cv::Mat& scores, const cv::Mat& geometry, float scoreThresh,
-        std::vector<cv::RotatedRect>& detections, std::vector<float>& confidences);
-    cv::Mat detectTextAreas(QImage &image, std::vector<cv::Rect>&);
+    void openPipelines(QList<FrameSource*> sources, const CapturePipeline::Config &config);
+    void startDisplay();
+    void stopPipelines();
+    void clearScene();
+    // The still image, or a copy of a live camera.
+    QPixmap currentPixmap(int camera = 0) const;
+    // Asks which live camera a setting is for, 0 with a single one, -1 when
+    // cancelled.
+    int selectCamera(const QString &title);
+    // The capture engines of the cameras shown, in tile order.
+    QList<CaptureEngine*> liveEngines() const;
 
 private slots:
     void openImage();
@@ -74,11 +88,27 @@ private slots:
     void zoomOut();
     void extractDimensions();
     void showCameraInfo();
+    void configureTextDetection();
+    void configureCameras();
+    void selectRegionsOfInterest();
+    void setRegionsOfInterest(int camera, QList<QRect> regions);
+    void selectMotionZones();
+    void setMotionZones(int camera, QList<QRect> areas);
+    void saveDetectorOutputs();
+    void benchmarkDecode();
     void openOCRUSBCamera();
     void openNectaCamera();
     void openOakDCamera();
-    void updateFrame(cv::Mat*);
-    void updateFrameNecta();
+    void openVideoFile();
+    void openTestPattern();
+    void setReplayOptions();
+    void setMotionRecording(bool enabled);
+    void showSavedVideo(QString name);
+    void seekVideoFile();
+    void refreshDisplay();
+    void showTelemetry();
+    void updateFrame(int index);
+    void showRecognizedText(int index, quint64 sequence, QString text, QVector<QRect> areas);
     void aboutDialog();
     //Capture Video int CaptureVideo();
 
@@ -86,6 +116,7 @@ private:
     QMenu *imageMenu;
     QMenu *videoMenu;
     QMenu *videoUSBMenu;
+    QMenu *replayMenu;
     QMenu *configMenu;
     QMenu *helpMenu;
 
@@ -93,11 +124,20 @@ private:
 
     QGraphicsScene *imageScene;
     QGraphicsView *imageView;
+    // live cameras are shown in videoWidget, still images in imageView
+    QStackedWidget *viewStack;
+    VideoWidget *videoWidget;
 
     QTextEdit *editor;
 
     QStatusBar *mainStatusBar;
     QLabel *mainStatusLabel;
+    QLabel *telemetryLabel;
+    // pulls the latest frame of every camera once per screen refresh
+    QTimer *displayTimer;
+    // metrics of every camera at the last status bar update
+    QElapsedTimer telemetryTime;
+    QVector<PipelineMetrics::Snapshot> telemetry;
 
     QAction *openAction;
     QAction *saveImageAsAction;
@@ -110,28 +150,43 @@ private:
     QAction *zoomOutAction;
     QAction *extractDimensionsAction;
     QAction *cameraInfoAction;
+    QAction *textDetectionAction;
+    QAction *camerasAction;
+    QAction *regionsOfInterestAction;
+    QAction *motionZonesAction;
+    QAction *saveDetectorOutputsAction;
+    QAction *benchmarkDecodeAction;
     QAction *OCRUSBcamera;
     QAction *calcFPSAction;
     QAction *NectaCamera;
     QAction *OakDCamera;
+    QAction *videoFileAction;
+    QAction *testPatternAction;
+    QAction *replayPacedAction;
+    QAction *replayLoopAction;
+    QAction *seekAction;
+    QAction *recordMotionAction;
     QAction *aboutAction;
 
     QString currentImagePath;
     QGraphicsPixmapItem *currentImage;
 
     tesseract::TessBaseAPI *tesseractAPI;
-    cv::dnn::Net net;
+    TextDetector detector;
+    QFuture<bool> detectorLoading;
+    TesseractPool *tesseractPool;
+    EventDispatcher *eventDispatcher;
     QCamera *camera;
     QCameraViewfinder *viewfinder;
 
-    cv::Mat currentFrame;
-
-    // for capture thread
-    QMutex *data_lock;
-    USBCaptureThread *capturer;
-    NectaCaptureThread *nectacapturer;
-    OakdCaptureThread *oakdcapturer;
-
+    // one pipeline per camera, shown as tiles of the preview
+    struct CameraView {
+        quint64 sequence;
+        QVector<QRect> areas;
+        QString text;
+    };
+    QList<CapturePipeline*> pipelines;
+    QVector<CameraView> views;
 };
 
 
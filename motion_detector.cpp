@@ -0,0 +1,205 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QSettings>
+#include <QVariantMap>
+
+#include "frame_ring.h"
+#include "motion_detector.h"
+
+MotionDetector::Config MotionDetector::Config::fromSettings(int camera)
+{
+    QSettings settings;
+    Config config;
+    config.width = settings.value("motion/width", 320).toInt();
+    config.min_area = settings.value("motion/min_area", 0.0005).toDouble();
+    config.noise_size = settings.value("motion/noise_size", 9).toInt();
+    config.boxes = settings.value("motion/boxes", true).toBool();
+    QString key = QString("motion/camera%1/zones").arg(camera);
+    // the first camera keeps the zones saved before they were per camera
+    if(camera == 0 && !settings.contains(key)) {
+        key = "motion/zones";
+    }
+    for(const QVariant &value : settings.value(key).toList()) {
+        QVariantMap map = value.toMap();
+        MotionZone zone;
+        zone.name = map.value("name").toString();
+        zone.area = map.value("area").toRect();
+        zone.on_area = map.value("on", config.min_area).toDouble();
+        zone.off_area = map.value("off", zone.on_area / 2).toDouble();
+        zone.actions = (map.value("record", true).toBool() ? MotionZone::RECORD : 0)
+            | (map.value("notify", true).toBool() ? MotionZone::NOTIFY : 0);
+        config.zones.append(zone);
+    }
+    if(config.zones.isEmpty()) {
+        config.zones.append(defaultZone(config.min_area));
+    }
+    return config;
+}
+
+void MotionDetector::Config::save(int camera) const
+{
+    QSettings settings;
+    settings.setValue("motion/width", width);
+    settings.setValue("motion/min_area", min_area);
+    settings.setValue("motion/noise_size", noise_size);
+    settings.setValue("motion/boxes", boxes);
+    QVariantList list;
+    for(const MotionZone &zone : zones) {
+        QVariantMap map;
+        map.insert("name", zone.name);
+        map.insert("area", zone.area);
+        map.insert("on", zone.on_area);
+        map.insert("off", zone.off_area);
+        map.insert("record", (zone.actions & MotionZone::RECORD) != 0);
+        map.insert("notify", (zone.actions & MotionZone::NOTIFY) != 0);
+        list.append(map);
+    }
+    settings.setValue(QString("motion/camera%1/zones").arg(camera), list);
+}
+
+MotionZone MotionDetector::Config::defaultZone(double min_area)
+{
+    return MotionZone{"frame", QRect(), min_area, min_area / 2,
+                      MotionZone::RECORD | MotionZone::NOTIFY};
+}
+
+MotionDetector::MotionDetector(const Config &config):
+    scale(1.0), moving_area(0), frames(0), total_time(0)
+{
+    setConfig(config);
+}
+
+void MotionDetector::setConfig(const Config &config)
+{
+    this->config = config;
+    if(this->config.zones.isEmpty()) {
+        this->config.zones.append(Config::defaultZone(config.min_area));
+    }
+    reset();
+}
+
+void MotionDetector::reset()
+{
+    // no shadow detection, shadows counted as motion before anyway
+    segmentor = cv::createBackgroundSubtractorMOG2(500, 16, false);
+    frame_size = cv::Size();
+    moving_area = 0;
+    moving_boxes.clear();
+    zone_states.assign(config.zones.size(), ZoneState{false, false, 0, 0, 0});
+}
+
+void MotionDetector::resize(const cv::Size &size)
+{
+    // a new size: new scale, kernel, zones and background
+    if(!frame_size.empty()) {
+        segmentor = cv::createBackgroundSubtractorMOG2(500, 16, false);
+    }
+    frame_size = size;
+    scale = config.width > 0 && config.width < size.width ? (double)config.width / size.width : 1.0;
+    analysis_size = cv::Size(std::max(1, cvRound(size.width * scale)),
+                             std::max(1, cvRound(size.height * scale)));
+    int noise = std::max(1, cvRound(config.noise_size * scale));
+    kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(noise, noise));
+
+    cv::Rect bounds(cv::Point(0, 0), analysis_size);
+    zone_rects.clear();
+    for(const MotionZone &zone : config.zones) {
+        if(zone.area.isNull()) {
+            zone_rects.push_back(bounds);
+            continue;
+        }
+        cv::Rect rect(cvRound(zone.area.x() * scale), cvRound(zone.area.y() * scale),
+                      cvRound(zone.area.width() * scale), cvRound(zone.area.height() * scale));
+        zone_rects.push_back(rect & bounds);
+    }
+}
+
+double MotionDetector::movingPixels(const cv::Rect &rect) const
+{
+    // sums has one more row and column than the analysed frame
+    int x0 = rect.x, y0 = rect.y, x1 = rect.x + rect.width, y1 = rect.y + rect.height;
+    if(sums.depth() == CV_32S) {
+        return (double)(sums.at<int>(y1, x1) - sums.at<int>(y0, x1)
+                        - sums.at<int>(y1, x0) + sums.at<int>(y0, x0)) / 255;
+    }
+    return (sums.at<double>(y1, x1) - sums.at<double>(y0, x1)
+            - sums.at<double>(y1, x0) + sums.at<double>(y0, x0)) / 255;
+}
+
+bool MotionDetector::apply(const cv::Mat &frame)
+{
+    qint64 start = FrameRing::now();
+    if(frame.size() != frame_size) {
+        resize(frame.size());
+    }
+
+    // shrink first, so the color conversion only sees the small frame
+    const cv::Mat *input = &frame;
+    if(analysis_size != frame_size) {
+        cv::resize(frame, small, analysis_size, 0, 0, cv::INTER_AREA);
+        input = &small;
+    }
+    if(input->channels() == 3) {
+        cv::cvtColor(*input, gray, cv::COLOR_BGR2GRAY);
+        input = &gray;
+    }
+    segmentor->apply(*input, mask);
+    cv::erode(mask, mask, kernel);
+
+    // 32 bit sums overflow past 8M moving pixels, only at full size
+    cv::integral(mask, sums, mask.total() < (1u << 23) ? CV_32S : CV_64F);
+    moving_area = movingPixels(cv::Rect(cv::Point(0, 0), analysis_size)) / mask.total();
+    bool any_active = false;
+    for(size_t i = 0; i < zone_rects.size(); i++) {
+        const MotionZone &zone = config.zones[i];
+        ZoneState &state = zone_states[i];
+        const cv::Rect &rect = zone_rects[i];
+        state.moving_area = rect.area() > 0 ? movingPixels(rect) / rect.area() : 0;
+        state.started = false;
+        if(!state.active && state.moving_area > zone.on_area) {
+            state.active = true;
+            state.started = true;
+            state.starts++;
+        } else if(state.active && state.moving_area <= zone.off_area) {
+            state.active = false;
+        }
+        if(state.active) {
+            state.active_frames++;
+            any_active = true;
+        }
+    }
+
+    moving_boxes.clear();
+    if(any_active && config.boxes) {
+        // grow the spots so the parts of one object end in one box
+        cv::dilate(mask, dilated, kernel, cv::Point(-1, -1), 3);
+        cv::findContours(dilated, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+        for(const std::vector<cv::Point> &contour : contours) {
+            cv::Rect box = cv::boundingRect(contour);
+            moving_boxes.push_back(cv::Rect((int)(box.x / scale), (int)(box.y / scale),
+                                            (int)(box.width / scale), (int)(box.height / scale)));
+        }
+    }
+
+    frames++;
+    total_time += FrameRing::now() - start;
+    return any_active;
+}
+
+QString MotionDetector::statistics() const
+{
+    QString text = QString("motion detection %1 ms per frame at %2x%3")
+        .arg(frames ? total_time / 1000.0 / frames : 0.0, 0, 'f', 2)
+        .arg(analysis_size.width).arg(analysis_size.height);
+    for(int i = 0; i < config.zones.size(); i++) {
+        text += QString(", %1: %2 starts, %3% active").arg(config.zones[i].name)
+            .arg(zone_states[i].starts)
+            .arg(frames ? 100.0 * zone_states[i].active_frames / frames : 0.0, 0, 'f', 1);
+    }
+    return text;
+}
@@ -0,0 +1,114 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef MOTION_DETECTOR_H
+#define MOTION_DETECTOR_H
+
+#include <vector>
+#include <QRect>
+#include <QString>
+#include <QVector>
+
+#include "opencv2/opencv.hpp"
+#include "opencv2/video/background_segm.hpp"
+
+// Part of the view watched on its own. A zone starts when the moving share
+// of its area goes above on_area and only ends when it falls back to
+// off_area or below, so motion around one threshold does not flicker.
+struct MotionZone
+{
+    enum Action {
+                 RECORD = 1,    // record while the zone is active
+                 NOTIFY = 2     // send a notification when it starts
+    };
+
+    QString name;
+    QRect area;         // in frame coordinates, null for the whole frame
+    double on_area;
+    double off_area;
+    int actions;
+};
+
+// Background subtraction on a small grayscale copy of each frame. Only the
+// number of moving pixels is needed to tell whether there is motion, so the
+// moving areas are only traced when boxes are asked for. The moving pixels
+// of every zone are read from one integral image of the foreground, four
+// lookups per zone, so zones cost next to nothing. The kernel and all the
+// intermediate images are kept between frames, so a stream of frames of one
+// size does not allocate.
+class MotionDetector
+{
+public:
+    struct Config {
+        int width;          // of the analysed frame, 0 for full size
+        double min_area;    // on_area of the default zone
+        int noise_size;     // moving spots smaller than this are ignored, in frame pixels
+        bool boxes;         // also find the boxes around the moving areas
+        QVector<MotionZone> zones;  // of one camera, the whole frame when none are saved
+
+        static Config fromSettings(int camera = 0);
+        void save(int camera = 0) const;
+        static MotionZone defaultZone(double min_area);
+    };
+
+    struct ZoneState {
+        bool active;
+        bool started;       // by the last frame
+        double moving_area;
+        quint64 starts;
+        quint64 active_frames;
+    };
+
+    explicit MotionDetector(const Config &config = Config::fromSettings());
+    const Config &currentConfig() const {return config; };
+    // Replaces the config and forgets the background.
+    void setConfig(const Config &config);
+    // Returns whether any zone of frame, BGR or gray, is active against the
+    // background learned from the previous frames.
+    bool apply(const cv::Mat &frame);
+    // Forgets the background, e.g. when the camera changes.
+    void reset();
+
+    // Of the last frame given to apply().
+    double movingArea() const {return moving_area; };
+    // In the order of currentConfig().zones.
+    const std::vector<ZoneState> &zoneStates() const {return zone_states; };
+    // Moving pixels of the analysed frame, 255 where moving.
+    const cv::Mat &foreground() const {return mask; };
+    // In frame coordinates, empty unless enabled in the config.
+    const std::vector<cv::Rect> &boxes() const {return moving_boxes; };
+
+    QString statistics() const;
+
+private:
+    void resize(const cv::Size &size);
+    // Moving pixels inside rect of the analysed frame.
+    double movingPixels(const cv::Rect &rect) const;
+
+private:
+    Config config;
+    cv::Ptr<cv::BackgroundSubtractorMOG2> segmentor;
+    cv::Size frame_size;
+    double scale;
+    cv::Size analysis_size;
+    cv::Mat kernel;
+    cv::Mat small;
+    cv::Mat gray;
+    cv::Mat mask;
+    cv::Mat dilated;
+    cv::Mat sums;
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Rect> moving_boxes;
+    double moving_area;
+    std::vector<cv::Rect> zone_rects;   // in the analysed frame
+    std::vector<ZoneState> zone_states;
+
+    quint64 frames;
+    qint64 total_time;      // microseconds
+};
+
+#endif // MOTION_DETECTOR_H
@@ -5,156 +5,77 @@
 
     You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
 */
-#include <QTime>
-#include <QtConcurrent>
 #include <QDebug>
 
-#include "utilities.h"
 #include "necta_camera.h"
 
-NectaCaptureThread::NectaCaptureThread(int camera, QMutex *lock):
-    running(false), cameraID(camera), videoPath(""), data_lock(lock)
+AlkeriaNectaSource::AlkeriaNectaSource(int camera):
+    index(camera), camera(nullptr), width(0), height(0)
 {
-    fps_calculating = false;
-    fps = 0.0;
-
-    frame_width = frame_height = 0;
-    video_saving_status = STOPPED;
-    saved_video_name = "";
-    video_writer = nullptr;
-
-    motion_detecting_status = false;
 }
 
-NectaCaptureThread::NectaCaptureThread(QString videoPath, QMutex *lock):
-    running(false), cameraID(-1), videoPath(videoPath), data_lock(lock)
+AlkeriaNectaSource::~AlkeriaNectaSource()
 {
-    fps_calculating = false;
-    fps = 0.0;
-
-    frame_width = frame_height = 0;
-    video_saving_status = STOPPED;
-    saved_video_name = "";
-    video_writer = nullptr;
-
-    motion_detecting_status = false;
+    close();
 }
 
-NectaCaptureThread::~NectaCaptureThread() {
-}
-
-void NectaCaptureThread::run() {
-    running = true;
-    cv::VideoCapture cap(cameraID);
-    // cv::VideoCapture cap("/home/kdr2/Videos/WIN_20190123_20_14_56_Pro.mp4");
-    cv::Mat tmp_frame;
-
-    frame_width = cap.get(cv::CAP_PROP_FRAME_WIDTH);
-    frame_height = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
-
-    segmentor = cv::createBackgroundSubtractorMOG2(500, 16, true);
-    CAlkUSB3::INectaCamera *myCam;
-    myCam= &CAlkUSB3::INectaCamera::Create();
-    if(myCam->GetCameraList().Size() ==0)
-    {
-       qDebug() << "Camera not connected";
-    }
-    else
-    {
-        qDebug() << "Camera connected";
-        myCam->SetCamera(0);
-        myCam->Init();
-        myCam->SetAcquire(true);
-    }
-    while(running) {
-        data_lock->lock();
-        myCam->GetImage(true).Save("/home/javi/prueba.bmp");
-        //sleep(0.1);
-        data_lock->unlock();
-        emit nectaframeCaptured();
-    }
-    CAlkUSB3::INectaCamera::Destroy(*myCam);
-    running = false;
+QString AlkeriaNectaSource::name() const
+{
+    return QString("Necta camera %1").arg(index);
 }
 
-void NectaCaptureThread::calculateFPS(cv::VideoCapture &cap)
+bool AlkeriaNectaSource::open()
 {
-    const int count_to_read = 100;
-    cv::Mat tmp_frame;
-    QTime timer;
-    timer.start();
-    for(int i = 0; i < count_to_read; i++) {
-            cap >> tmp_frame;
+    camera = &CAlkUSB3::INectaCamera::Create();
+    if(camera->GetCameraList().Size() == 0) {
+        CAlkUSB3::INectaCamera::Destroy(*camera);
+        camera = nullptr;
+        return false;
     }
-    int elapsed_ms = timer.elapsed();
-    fps = count_to_read / (elapsed_ms / 1000.0);
-    fps_calculating = false;
-    emit fpsChanged(fps);
+    camera->SetCamera(index);
+    camera->Init();
+    width = camera->GetWidth();
+    height = camera->GetHeight();
+    camera->SetAcquire(true);
+    return true;
 }
 
-
-void NectaCaptureThread::startSavingVideo(cv::Mat &firstFrame)
+bool AlkeriaNectaSource::read(cv::Mat &frame)
 {
-    saved_video_name = Utilities::newSavedVideoName();
-
-    QString cover = Utilities::getSavedVideoPath(saved_video_name, "jpg");
-    cv::imwrite(cover.toStdString(), firstFrame);
-
-    video_writer = new cv::VideoWriter(
-        Utilities::getSavedVideoPath(saved_video_name, "avi").toStdString(),
-        cv::VideoWriter::fourcc('M','J','P','G'),
-        fps? fps: 30,
-        cv::Size(frame_width,frame_height));
-    video_saving_status = STARTED;
+    if(camera == nullptr) {
+        return false;
+    }
+    buffer = camera->GetRawData();
+    size_t pixels = (size_t)width * height;
+    if(buffer.Data() == nullptr || buffer.Size() < pixels) {
+        // incomplete transfer, the engine skips empty frames
+        frame.release();
+        return true;
+    }
+    if(buffer.Size() != pixels) {
+        qDebug() << name() << "sends" << buffer.Size() << "bytes per frame, only 8 bit mono"
+                 << width << "x" << height << "is supported";
+        return false;
+    }
+    // the SDK reuses its buffer for the next frames while the ring slot is
+    // still held by the display, OCR or the recorder, so it is copied into
+    // the slot; the slot image is reused, so there is no allocation
+    cv::Mat(height, width, CV_8UC1, (void *)buffer.Data()).copyTo(frame);
+    return true;
 }
 
-
-void NectaCaptureThread::stopSavingVideo()
+void AlkeriaNectaSource::close()
 {
-    video_saving_status = STOPPED;
-    video_writer->release();
-    delete video_writer;
-    video_writer = nullptr;
-    emit videoSaved(saved_video_name);
+    if(camera == nullptr) {
+        return;
+    }
+    camera->SetAcquire(false);
+    buffer = CAlkUSB3::BufferPtr();
+    CAlkUSB3::INectaCamera::Destroy(*camera);
+    camera = nullptr;
 }
 
-
-void NectaCaptureThread::motionDetect(cv::Mat &frame)
+FrameSource *AlkeriaNectaSource::simulator()
 {
-    cv::Mat fgmask;
-    segmentor->apply(frame, fgmask);
-    if (fgmask.empty()) {
-            return;
-    }
-
-    cv::threshold(fgmask, fgmask, 25, 255, cv::THRESH_BINARY);
-
-    int noise_size = 9;
-    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(noise_size, noise_size));
-    cv::erode(fgmask, fgmask, kernel);
-    kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(noise_size, noise_size));
-    cv::dilate(fgmask, fgmask, kernel, cv::Point(-1,-1), 3);
-
-    vector<vector<cv::Point> > contours;
-    cv::findContours(fgmask, contours, cv::RETR_TREE, cv::CHAIN_APPROX_SIMPLE);
-
-    bool has_motion = contours.size() > 0;
-    if(!motion_detected && has_motion) {
-        motion_detected = true;
-        setVideoSavingStatus(STARTING);
-        qDebug() << "new motion detected, should send a notification.";
-        QtConcurrent::run(Utilities::notifyMobile, cameraID);
-    } else if (motion_detected && !has_motion) {
-        motion_detected = false;
-        setVideoSavingStatus(STOPPING);
-        qDebug() << "detected motion disappeared.";
-    }
-
-    cv::Scalar color = cv::Scalar(0, 0, 255); // red
-    for(size_t i = 0; i < contours.size(); i++) {
-        cv::Rect rect = cv::boundingRect(contours[i]);
-        cv::rectangle(frame, rect, color, 1);
-        //cv::drawContours(frame, contours, (int)i, color, 1);
-    }
+    return new SyntheticFrameSource(cv::Size(1280, 1024), CV_8UC1, 100, "NECTA");
 }
-
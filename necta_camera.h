@@ -9,75 +9,30 @@
 #define NECTA_CAMERA_H
 
 #include <INectaCamera.h>
-#include <QString>
-#include <QThread>
-#include <QMutex>
-#include <unistd.h>
 
-#include "opencv2/opencv.hpp"
-#include "opencv2/videoio.hpp"
-#include "opencv2/video/background_segm.hpp"
+#include "frame_source.h"
 
-using namespace std;
-
-class NectaCaptureThread : public QThread
+// Alkeria Necta line camera. Without hardware use a SyntheticFrameSource of
+// the sensor size instead, see simulator().
+class AlkeriaNectaSource : public FrameSource
 {
-    Q_OBJECT
 public:
-    NectaCaptureThread(int camera, QMutex *lock);
-    NectaCaptureThread(QString videoPath, QMutex *lock);
-    ~NectaCaptureThread();
-    void setRunning(bool run) {running = run; };
-    void startCalcFPS() {fps_calculating = true; };
-    enum VideoSavingStatus {
-                            STARTING,
-                            STARTED,
-                            STOPPING,
-                            STOPPED
-    };
-
-    void setVideoSavingStatus(VideoSavingStatus status) {video_saving_status = status; };
-    void setMotionDetectingStatus(bool status) {
-        motion_detecting_status = status;
-        motion_detected = false;
-        if(video_saving_status != STOPPED) video_saving_status = STOPPING;
-    };
-
-protected:
-    void run() override;
-
-signals:
-    void nectaframeCaptured();
-    void fpsChanged(float fps);
-    void videoSaved(QString name);
+    explicit AlkeriaNectaSource(int camera = 0);
+    ~AlkeriaNectaSource();
+    QString name() const override;
+    bool open() override;
+    bool read(cv::Mat &frame) override;
+    void close() override;
 
-private:
-    void calculateFPS(cv::VideoCapture &cap);
-    void startSavingVideo(cv::Mat &firstFrame);
-    void stopSavingVideo();
-    void motionDetect(cv::Mat &frame);
+    // Gray test pattern of the sensor size, selected by setting
+    // HSK_NECTA_SIMULATOR in the environment.
+    static FrameSource *simulator();
 
 private:
-    bool running;
-    int cameraID;
-    QString videoPath;
-    QMutex *data_lock;
-    cv::Mat frame;
-
-    // FPS calculating
-    bool fps_calculating;
-    float fps;
-
-    // video saving
-    int frame_width, frame_height;
-    VideoSavingStatus video_saving_status;
-    QString saved_video_name;
-    cv::VideoWriter *video_writer;
-
-    // motion analysis
-    bool motion_detecting_status;
-    bool motion_detected;
-    cv::Ptr<cv::BackgroundSubtractorMOG2> segmentor;
+    int index;
+    CAlkUSB3::INectaCamera *camera;
+    CAlkUSB3::BufferPtr buffer;
+    int width, height;
 };
 
 #endif // NECTA_CAMERA_H
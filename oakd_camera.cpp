@@ -5,139 +5,126 @@
 
     You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
 */
-#include "oakd_camera.h"
-#include <QTime>
-#include <QtConcurrent>
+#include <cstring>
+#include <QCoreApplication>
+#include <QDir>
+#include <QSettings>
 #include <QDebug>
-#include "utilities.h"
 
+#include "oakd_camera.h"
 
-OakdCaptureThread::OakdCaptureThread(int camera, QMutex *lock):
-    running(false), cameraID(camera), videoPath(""), data_lock(lock)
-{
-    fps_calculating = false;
-    fps = 0.0;
+static_assert(sizeof(OakdFrameSource::FrameHeader) == 32, "OAK-D stream header is 32 bytes");
 
-    frame_width = frame_height = 0;
-    video_saving_status = STOPPED;
-    saved_video_name = "";
-    video_writer = nullptr;
+// larger frames are taken for a corrupted stream, not allocated
+static const quint32 MAX_SIDE = 8192;
 
-    motion_detecting_status = false;
+OakdFrameSource::OakdFrameSource(int camera):
+    cameraID(camera), process(nullptr)
+{
+    timeout = qMax(1, QSettings().value("oakd/timeout", 5).toInt());
 }
 
-OakdCaptureThread::OakdCaptureThread(QString videoPath, QMutex *lock):
-    running(false), cameraID(-1), videoPath(videoPath), data_lock(lock)
+OakdFrameSource::~OakdFrameSource()
 {
-    fps_calculating = false;
-    fps = 0.0;
-
-    frame_width = frame_height = 0;
-    video_saving_status = STOPPED;
-    saved_video_name = "";
-    video_writer = nullptr;
-
-    motion_detecting_status = false;
+    close();
 }
 
-OakdCaptureThread::~OakdCaptureThread() {
+QString OakdFrameSource::name() const
+{
+    return QString("OAK-D camera %1").arg(cameraID);
 }
 
-void OakdCaptureThread::run() {
-    running = true;
-    cv::VideoCapture cap(cameraID);
-    // cv::VideoCapture cap("/home/kdr2/Videos/WIN_20190123_20_14_56_Pro.mp4");
-    cv::Mat tmp_frame;
-
-    frame_width = cap.get(cv::CAP_PROP_FRAME_WIDTH);
-    frame_height = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
-
-    segmentor = cv::createBackgroundSubtractorMOG2(500, 16, true);
-    while(running) {
-        data_lock->lock();
-        system("python3 /home/javi/Documentos/Programacion/Python/Video.py");
-        data_lock->unlock();
-    }
-    running = false;
+QString OakdFrameSource::program()
+{
+    return QSettings().value("oakd/python", "python3").toString();
 }
 
-void OakdCaptureThread::calculateFPS(cv::VideoCapture &cap)
+QStringList OakdFrameSource::arguments(int camera)
 {
-    const int count_to_read = 100;
-    cv::Mat tmp_frame;
-    QTime timer;
-    timer.start();
-    for(int i = 0; i < count_to_read; i++) {
-            cap >> tmp_frame;
+    QString script = QDir(QCoreApplication::applicationDirPath()).absoluteFilePath("oakd_stream.py");
+    QStringList args;
+    args << QSettings().value("oakd/producer", script).toString();
+    args << "--device" << QString::number(camera);
+    if(qEnvironmentVariableIsSet("HSK_OAKD_SIMULATOR")) {
+        args << "--synthetic";
     }
-    int elapsed_ms = timer.elapsed();
-    fps = count_to_read / (elapsed_ms / 1000.0);
-    fps_calculating = false;
-    emit fpsChanged(fps);
+    return args;
 }
 
-
-void OakdCaptureThread::startSavingVideo(cv::Mat &firstFrame)
+bool OakdFrameSource::open()
 {
-    saved_video_name = Utilities::newSavedVideoName();
-
-    QString cover = Utilities::getSavedVideoPath(saved_video_name, "jpg");
-    cv::imwrite(cover.toStdString(), firstFrame);
-
-    video_writer = new cv::VideoWriter(
-        Utilities::getSavedVideoPath(saved_video_name, "avi").toStdString(),
-        cv::VideoWriter::fourcc('M','J','P','G'),
-        fps? fps: 30,
-        cv::Size(frame_width,frame_height));
-    video_saving_status = STARTED;
+    process = new QProcess();
+    // the producer logs on stderr, keep it visible
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    process->start(program(), arguments(cameraID), QIODevice::ReadOnly);
+    if(!process->waitForStarted(5000)) {
+        qDebug() << "Cannot start the OAK-D producer:" << process->errorString();
+        close();
+        return false;
+    }
+    return true;
 }
 
-
-void OakdCaptureThread::stopSavingVideo()
+bool OakdFrameSource::readExactly(char *data, qint64 size)
 {
-    video_saving_status = STOPPED;
-    video_writer->release();
-    delete video_writer;
-    video_writer = nullptr;
-    emit videoSaved(saved_video_name);
+    // the pipe is read without an event loop, QProcess fills its buffer
+    // while waiting for data. A producer that is alive but silent, e.g. on
+    // a stalled device, ends the capture after timeout seconds, so stopping
+    // it never waits longer than that.
+    int silent = 0;
+    while(size > 0) {
+        if(process->bytesAvailable() == 0 && !process->waitForReadyRead(1000)) {
+            if(process->state() == QProcess::NotRunning) {
+                return false;
+            }
+            if(++silent >= timeout) {
+                qDebug() << "No data from the OAK-D producer for" << timeout << "s";
+                return false;
+            }
+            continue;
+        }
+        silent = 0;
+        qint64 count = process->read(data, size);
+        if(count < 0) {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
 }
 
-
-void OakdCaptureThread::motionDetect(cv::Mat &frame)
+bool OakdFrameSource::read(cv::Mat &frame)
 {
-    cv::Mat fgmask;
-    segmentor->apply(frame, fgmask);
-    if (fgmask.empty()) {
-            return;
+    if(process == nullptr) {
+        return false;
     }
-
-    cv::threshold(fgmask, fgmask, 25, 255, cv::THRESH_BINARY);
-
-    int noise_size = 9;
-    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(noise_size, noise_size));
-    cv::erode(fgmask, fgmask, kernel);
-    kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(noise_size, noise_size));
-    cv::dilate(fgmask, fgmask, kernel, cv::Point(-1,-1), 3);
-
-    vector<vector<cv::Point> > contours;
-    cv::findContours(fgmask, contours, cv::RETR_TREE, cv::CHAIN_APPROX_SIMPLE);
-
-    bool has_motion = contours.size() > 0;
-    if(!motion_detected && has_motion) {
-        motion_detected = true;
-        setVideoSavingStatus(STARTING);
-        qDebug() << "new motion detected, should send a notification.";
-        QtConcurrent::run(Utilities::notifyMobile, cameraID);
-    } else if (motion_detected && !has_motion) {
-        motion_detected = false;
-        setVideoSavingStatus(STOPPING);
-        qDebug() << "detected motion disappeared.";
+    FrameHeader header;
+    if(!readExactly((char *)&header, sizeof(header))) {
+        return false;
+    }
+    if(std::memcmp(header.magic, "HSKF", 4) != 0
+       || (header.channels != 1 && header.channels != 3)
+       || header.width == 0 || header.height == 0
+       || header.width > MAX_SIDE || header.height > MAX_SIDE) {
+        qDebug() << "Corrupted OAK-D stream";
+        return false;
     }
+    // straight into the ring slot, no intermediate frame
+    frame.create(header.height, header.width, header.channels == 3 ? CV_8UC3 : CV_8UC1);
+    return readExactly((char *)frame.data, (qint64)frame.total() * frame.elemSize());
+}
 
-    cv::Scalar color = cv::Scalar(0, 0, 255); // red
-    for(size_t i = 0; i < contours.size(); i++) {
-        cv::Rect rect = cv::boundingRect(contours[i]);
-        cv::rectangle(frame, rect, color, 1);
-        //cv::drawContours(frame, contours, (int)i, color, 1);
+void OakdFrameSource::close()
+{
+    if(process == nullptr) {
+        return;
+    }
+    process->terminate();
+    if(!process->waitForFinished(2000)) {
+        process->kill();
+        process->waitForFinished(1000);
     }
+    delete process;
+    process = nullptr;
 }
@@ -8,73 +8,61 @@
 #ifndef OAKD_CAMERA_H
 #define OAKD_CAMERA_H
 
+#include <QProcess>
 #include <QString>
-#include <QThread>
-#include <QMutex>
-#include <unistd.h>
+#include <QStringList>
 
-#include "opencv2/opencv.hpp"
-#include "opencv2/videoio.hpp"
-#include "opencv2/video/background_segm.hpp"
+#include "frame_source.h"
 
-using namespace std;
-
-class OakdCaptureThread : public QThread
+// Luxonis OAK-D. The DepthAI pipeline runs in a long-lived Python producer
+// (oakd_stream.py) that streams raw frames on its stdout, so the interpreter
+// and the device are started once per capture, not once per frame.
+//
+// Stream protocol, every integer little endian:
+//
+//     offset  size  field
+//          0     4  magic, the bytes "HSKF"
+//          4     4  width in pixels
+//          8     4  height in pixels
+//         12     4  channels, 3 for BGR or 1 for gray
+//         16     8  sequence number, counted by the producer
+//         24     8  capture time in microseconds, CLOCK_MONOTONIC
+//         32     -  width * height * channels bytes, rows packed
+//
+// Frames are at most 8192 pixels a side. Setting HSK_OAKD_SIMULATOR in the
+// environment starts the producer with --synthetic, so it writes a test
+// pattern instead of opening the device.
+class OakdFrameSource : public FrameSource
 {
-    Q_OBJECT
 public:
-    OakdCaptureThread(int camera, QMutex *lock);
-    OakdCaptureThread(QString videoPath, QMutex *lock);
-    ~OakdCaptureThread();
-    void setRunning(bool run) {running = run; };
-    void startCalcFPS() {fps_calculating = true; };
-    enum VideoSavingStatus {
-                            STARTING,
-                            STARTED,
-                            STOPPING,
-                            STOPPED
-    };
-
-    void setVideoSavingStatus(VideoSavingStatus status) {video_saving_status = status; };
-    void setMotionDetectingStatus(bool status) {
-        motion_detecting_status = status;
-        motion_detected = false;
-        if(video_saving_status != STOPPED) video_saving_status = STOPPING;
+    struct FrameHeader {
+        char magic[4];
+        quint32 width;
+        quint32 height;
+        quint32 channels;
+        quint64 sequence;
+        quint64 timestamp;
     };
 
-protected:
-    void run() override;
+    explicit OakdFrameSource(int camera = 0);
+    ~OakdFrameSource();
+    QString name() const override;
+    bool open() override;
+    bool read(cv::Mat &frame) override;
+    void close() override;
 
-signals:
-    void fpsChanged(float fps);
-    void videoSaved(QString name);
+    // Producer command line, from the "oakd/python" and "oakd/producer"
+    // settings.
+    static QString program();
+    static QStringList arguments(int camera);
 
 private:
-    void calculateFPS(cv::VideoCapture &cap);
-    void startSavingVideo(cv::Mat &firstFrame);
-    void stopSavingVideo();
-    void motionDetect(cv::Mat &frame);
+    bool readExactly(char *data, qint64 size);
 
 private:
-    bool running;
     int cameraID;
-    QString videoPath;
-    QMutex *data_lock;
-    cv::Mat frame;
-
-    // FPS calculating
-    bool fps_calculating;
-    float fps;
-
-    // video saving
-    int frame_width, frame_height;
-    VideoSavingStatus video_saving_status;
-    QString saved_video_name;
-    cv::VideoWriter *video_writer;
-
-    // motion analysis
-    bool motion_detecting_status;
-    bool motion_detected;
-    cv::Ptr<cv::BackgroundSubtractorMOG2> segmentor;
+    QProcess *process;   // created in the capture thread by open()
+    int timeout;         // seconds without data, from "oakd/timeout"
 };
+
 #endif // OAKD_CAMERA_H
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+#  Copyright 2022 Javier Alvarez
+#  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+"""Streams OAK-D color frames to HSK Vision on stdout.
+
+Every frame is a 32 byte little endian header followed by the raw pixels,
+see OakdFrameSource in oakd_camera.h:
+
+    magic "HSKF", width u32, height u32, channels u32,
+    sequence u64, capture time u64 (microseconds, CLOCK_MONOTONIC)
+
+With --synthetic a moving test pattern is written instead, so the
+application side can be run without the device or depthai installed.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+HEADER = struct.Struct("<4sIIIQQ")
+
+
+def write_frame(out, sequence, width, height, channels, pixels, timestamp_us):
+    out.write(HEADER.pack(b"HSKF", width, height, channels, sequence, timestamp_us))
+    out.write(pixels)
+    out.flush()
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+def stream_device(out, args):
+    import depthai as dai
+
+    pipeline = dai.Pipeline()
+    camera = pipeline.create(dai.node.ColorCamera)
+    camera.setPreviewSize(args.width, args.height)
+    camera.setInterleaved(True)
+    camera.setColorOrder(dai.ColorCameraProperties.ColorOrder.BGR)
+    camera.setFps(args.fps)
+    xout = pipeline.create(dai.node.XLinkOut)
+    xout.setStreamName("preview")
+    camera.preview.link(xout.input)
+
+    devices = dai.Device.getAllAvailableDevices()
+    if args.device >= len(devices):
+        sys.exit("OAK-D %d not found, %d connected" % (args.device, len(devices)))
+    with dai.Device(pipeline, devices[args.device]) as device:
+        # keep only the newest frames when the reader falls behind
+        queue = device.getOutputQueue("preview", maxSize=2, blocking=False)
+        sequence = 0
+        while True:
+            frame = queue.get().getCvFrame()
+            height, width = frame.shape[:2]
+            channels = 1 if frame.ndim == 2 else frame.shape[2]
+            write_frame(out, sequence, width, height, channels, frame.tobytes(), now_us())
+            sequence += 1
+
+
+def stream_synthetic(out, args):
+    # plain bytes, so the stand-in needs nothing beyond the standard library
+    width, height = args.width, args.height
+    gradient = b"".join(bytes((x * 255 // width,) * 3) for x in range(width))
+    gradient += gradient
+    block = height // 4
+    red = bytes((0, 0, 255))
+    period = 1.0 / args.fps
+    due = time.monotonic()
+    sequence = 0
+    while True:
+        shift = sequence % width
+        frame = bytearray(gradient[shift * 3:(shift + width) * 3] * height)
+        x = sequence * 4 % (width + block) - block
+        left, right = max(x, 0), min(x + block, width)
+        if right > left:
+            for y in range(height - block - 10, height - 10):
+                start = (y * width + left) * 3
+                frame[start:start + (right - left) * 3] = red * (right - left)
+        write_frame(out, sequence, width, height, 3, frame, now_us())
+        sequence += 1
+        due += period
+        delay = due - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--device", type=int, default=0, help="index of the OAK-D to open")
+    parser.add_argument("--width", type=int, default=1280)
+    parser.add_argument("--height", type=int, default=720)
+    parser.add_argument("--fps", type=float, default=30)
+    parser.add_argument("--synthetic", action="store_true",
+                        help="write a test pattern instead of opening the device")
+    args = parser.parse_args()
+
+    out = sys.stdout.buffer
+    try:
+        if args.synthetic:
+            stream_synthetic(out, args)
+        else:
+            stream_device(out, args)
+    except (BrokenPipeError, KeyboardInterrupt):
+        # the application closed the stream
+        pass
+
+
+if __name__ == "__main__":
+    main()
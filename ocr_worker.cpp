@@ -0,0 +1,265 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <QDebug>
+#include <QSettings>
+
+#include "utilities.h"
+#include "ocr_worker.h"
+
+OcrWorker::OcrWorker(OcrWorkerPool *pool, tesseract::TessBaseAPI *api):
+    pool(pool), tesseractAPI(api)
+{
+}
+
+OcrWorker::~OcrWorker() {
+    tesseractAPI->End();
+    delete tesseractAPI;
+}
+
+void OcrWorker::run() {
+    Utilities::pinCurrentThread(pool->cpu_affinity);
+    // load the network before the first frame arrives, off the GUI thread
+    detector.load();
+    int settings_generation = 0;
+    TextDetector::Config config;
+    QList<QRect> regions_of_interest;
+    OcrJob job;
+    while(pool->takeJob(job)) {
+        if(pool->settingsChanged(settings_generation, config, regions_of_interest)) {
+            detector.setConfig(config);
+        }
+        const cv::Mat &image = job.frame.image();
+        std::vector<cv::Rect> regions =
+            TextDetector::clipRegions(regions_of_interest, image.size());
+        QString text;
+        QVector<QRect> areas;
+        qint64 start = FrameRing::now();
+        if(job.detect_areas) {
+            std::vector<cv::Rect> rects;
+            detector.detect(image, regions, rects);
+            qint64 detected = FrameRing::now();
+            if(pool->metrics != nullptr) {
+                pool->metrics->record(PipelineMetrics::EAST, detected - start);
+            }
+            start = detected;
+            text = recognizeChanged(job, rects);
+            for(cv::Rect &rect : rects) {
+                areas.append(QRect(rect.x, rect.y, rect.width, rect.height));
+            }
+        } else if(!regions.empty()) {
+            // without detection every region is recognized as a whole
+            text = recognizeChanged(job, regions);
+        } else {
+            TesseractPool::setImage(tesseractAPI, image, cv::Rect(0, 0, image.cols, image.rows));
+            char *outText = tesseractAPI->GetUTF8Text();
+            text = QString::fromUtf8(outText);
+            delete [] outText;
+        }
+        if(pool->metrics != nullptr) {
+            pool->metrics->record(PipelineMetrics::TESSERACT, FrameRing::now() - start);
+        }
+        quint64 sequence = job.frame.sequence();
+        // release the ring slot before handing the result over
+        job.frame = FrameRef();
+        emit pool->textRecognized(sequence, text, areas);
+    }
+}
+
+QString OcrWorker::recognizeChanged(const OcrJob &job, std::vector<cv::Rect> &areas)
+{
+    const cv::Mat &image = job.frame.image();
+    TesseractPool::sortReadingOrder(areas);
+    std::vector<QString> texts(areas.size());
+    std::vector<cv::Rect> pending;
+    std::vector<size_t> pending_index;
+    for(size_t i = 0; i < areas.size(); i++) {
+        if(!ChangeDetector::intersects(job.changed_cells, areas[i], image.size())
+           && pool->cachedText(areas[i], job.reference_sequence, texts[i])) {
+            continue;
+        }
+        pending.push_back(areas[i]);
+        pending_index.push_back(i);
+    }
+    std::vector<QString> recognized = pool->tesseract_pool->recognizeEach(image, pending);
+    for(size_t k = 0; k < pending.size(); k++) {
+        texts[pending_index[k]] = recognized[k];
+    }
+    pool->storeTexts(job.frame.sequence(), areas, texts);
+    return TesseractPool::joinTexts(texts);
+}
+
+OcrWorkerPool::OcrWorkerPool(TesseractPool *tesseract_pool, int worker_count,
+                             const QList<int> &cpus, QObject *parent):
+    QObject(parent), tesseract_pool(tesseract_pool), cpu_affinity(cpus),
+    stopping(false), drop_stale(true), stale_frames(0),
+    detector_config(TextDetector::Config::fromSettings()),
+    settings_generation(1),
+    metrics(nullptr),
+    change_detector(QSettings().value("ocr/change_threshold", 8.0).toDouble()),
+    last_detect_areas(false), reference_sequence(0), unchanged_frames(0), cached_sequence(0)
+{
+    qRegisterMetaType<QVector<QRect>>("QVector<QRect>");
+    if(worker_count <= 0) {
+        worker_count = qMax(1, QThread::idealThreadCount() - 1);
+    }
+
+    // Tesseract needs the C locale while it is created and initialized
+    char *old_ctype = strdup(setlocale(LC_ALL, NULL));
+    setlocale(LC_ALL, "C");
+    for(int i = 0; i < worker_count; i++) {
+        tesseract::TessBaseAPI *api = new tesseract::TessBaseAPI();
+        // Initialize tesseract-ocr with English, with specifying tessdata path
+        if (api->Init(TESSDATA_PREFIX, "eng")) {
+            qDebug() << "Tesseract could not be initialized.";
+            delete api;
+            break;
+        }
+        workers.append(new OcrWorker(this, api));
+    }
+    setlocale(LC_ALL, old_ctype);
+    free(old_ctype);
+
+    for(OcrWorker *worker : workers) {
+        worker->start();
+    }
+}
+
+OcrWorkerPool::~OcrWorkerPool()
+{
+    queue_lock.lock();
+    stopping = true;
+    jobs.clear();
+    queue_changed.wakeAll();
+    queue_lock.unlock();
+    for(OcrWorker *worker : workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void OcrWorkerPool::submit(const FrameRef &frame, bool detect_areas)
+{
+    if(!isReady()) {
+        return;
+    }
+    if(detect_areas != last_detect_areas) {
+        last_detect_areas = detect_areas;
+        change_detector.reset();
+    }
+    if(!change_detector.update(frame.image())) {
+        unchanged_frames++;
+        return;
+    }
+    // the cells changed since the frame queued before this one
+    cv::Mat changed_cells = change_detector.changedCells().clone();
+    quint64 reference = reference_sequence;
+    reference_sequence = frame.sequence();
+    QMutexLocker locker(&queue_lock);
+    while(drop_stale && jobs.size() >= (size_t)workers.size()) {
+        // the dropped frame is never recognized, so the frame after it must
+        // also recognize the cells it changed, and only reuse the texts of
+        // the frame it changed from
+        OcrJob dropped = std::move(jobs.front());
+        jobs.pop_front();
+        cv::Mat &next_cells = jobs.empty() ? changed_cells : jobs.front().changed_cells;
+        quint64 &next_reference = jobs.empty() ? reference : jobs.front().reference_sequence;
+        if(dropped.changed_cells.empty() || dropped.changed_cells.size() != next_cells.size()) {
+            next_cells.release();
+        } else if(!next_cells.empty()) {
+            cv::bitwise_or(next_cells, dropped.changed_cells, next_cells);
+        }
+        next_reference = dropped.reference_sequence;
+        stale_frames++;
+    }
+    jobs.push_back(OcrJob{frame, detect_areas, changed_cells, reference});
+    queue_changed.wakeOne();
+}
+
+quint64 OcrWorkerPool::staleFrames()
+{
+    QMutexLocker locker(&queue_lock);
+    return stale_frames;
+}
+
+bool OcrWorkerPool::takeJob(OcrJob &job)
+{
+    QMutexLocker locker(&queue_lock);
+    while(jobs.empty() && !stopping) {
+        queue_changed.wait(&queue_lock);
+    }
+    if(stopping) {
+        return false;
+    }
+    job = std::move(jobs.front());
+    jobs.pop_front();
+    return true;
+}
+
+void OcrWorkerPool::setDetectorConfig(const TextDetector::Config &config)
+{
+    change_detector.reset();
+    QMutexLocker locker(&queue_lock);
+    detector_config = config;
+    settings_generation++;
+}
+
+void OcrWorkerPool::setRegionsOfInterest(const QList<QRect> &regions)
+{
+    change_detector.reset();
+    QMutexLocker locker(&queue_lock);
+    regions_of_interest = regions;
+    settings_generation++;
+}
+
+bool OcrWorkerPool::settingsChanged(int &generation, TextDetector::Config &config, QList<QRect> &regions)
+{
+    QMutexLocker locker(&queue_lock);
+    if(generation == settings_generation) {
+        return false;
+    }
+    generation = settings_generation;
+    config = detector_config;
+    regions = regions_of_interest;
+    return true;
+}
+
+bool OcrWorkerPool::cachedText(const cv::Rect &area, quint64 reference, QString &text)
+{
+    // an area matches when it overlaps a cached one almost entirely
+    QMutexLocker locker(&cache_lock);
+    if(cached_sequence != reference || cached_areas.empty()) {
+        return false;
+    }
+    for(size_t i = 0; i < cached_areas.size(); i++) {
+        const cv::Rect &cached = cached_areas[i];
+        double overlap = (area & cached).area();
+        double total = area.area() + cached.area() - overlap;
+        if(total > 0 && overlap / total >= 0.7) {
+            text = cached_texts[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void OcrWorkerPool::storeTexts(quint64 sequence, const std::vector<cv::Rect> &areas,
+                               const std::vector<QString> &texts)
+{
+    QMutexLocker locker(&cache_lock);
+    // workers finish out of order, never replace texts of a newer frame
+    if(sequence < cached_sequence) {
+        return;
+    }
+    cached_sequence = sequence;
+    cached_areas = areas;
+    cached_texts = texts;
+}
@@ -0,0 +1,141 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef OCR_WORKER_H
+#define OCR_WORKER_H
+
+#include <deque>
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QRect>
+#include <QString>
+
+#include "tesseract/baseapi.h"
+
+#include "frame_ring.h"
+#include "pipeline_metrics.h"
+#include "text_detector.h"
+#include "tesseract_pool.h"
+#include "change_detector.h"
+
+class OcrWorkerPool;
+
+struct OcrJob
+{
+    FrameRef frame;
+    bool detect_areas;
+    cv::Mat changed_cells;   // see ChangeDetector::changedCells()
+    quint64 reference_sequence; // of the frame the cells changed from
+};
+
+// Recognizes queued frames with its own Tesseract instance and text detector.
+class OcrWorker : public QThread
+{
+    Q_OBJECT
+public:
+    OcrWorker(OcrWorkerPool *pool, tesseract::TessBaseAPI *api);
+    ~OcrWorker();
+
+protected:
+    void run() override;
+
+private:
+    QString recognizeChanged(const OcrJob &job, std::vector<cv::Rect> &areas);
+
+private:
+    OcrWorkerPool *pool;
+    tesseract::TessBaseAPI *tesseractAPI;
+    TextDetector detector;
+};
+
+// Runs OCR on live frames off the GUI thread, restricted to the regions of
+// interest when some are set. Frames are queued up to one per worker; when
+// the workers fall behind the oldest pending frame is dropped, so results
+// always describe a recent frame. Without dropping, for benchmarks, the
+// queue is only bounded by the ring slots its frames hold. Results are
+// delivered through textRecognized() and may arrive out of order, so
+// receivers should ignore a sequence number older than the last one they
+// handled.
+//
+// Frames that do not differ from the last queued one are not queued at
+// all, the previous result stays valid. A dropped frame passes its changed
+// cells on to the frame queued after it. In changed frames, text areas that
+// lie in unchanged parts of the scene reuse the text recognized before, but
+// only when it is the text of the frame the cells changed from: with several
+// workers that frame may still be in recognition.
+class OcrWorkerPool : public QObject
+{
+    Q_OBJECT
+public:
+    // worker_count <= 0 uses one worker per core, minus one for capture.
+    // Detected text areas are recognized in parallel on tesseract_pool.
+    // There are no regions of interest until setRegionsOfInterest().
+    // Workers are pinned to cpus when it is not empty.
+    OcrWorkerPool(TesseractPool *tesseract_pool, int worker_count = 0,
+                  const QList<int> &cpus = QList<int>(), QObject *parent = nullptr);
+    ~OcrWorkerPool();
+
+    bool isReady() const {return !workers.isEmpty(); };
+    int workerCount() const {return workers.size(); };
+    // Must always be called from the same thread.
+    void submit(const FrameRef &frame, bool detect_areas);
+    quint64 staleFrames();
+    // Whether a frame queued behind busy workers replaces the oldest pending
+    // one, the default, or waits for its turn.
+    void setDropStale(bool drop) {drop_stale = drop; };
+    quint64 unchangedFrames() const {return unchanged_frames; };
+    // Applied by every worker before its next frame.
+    void setDetectorConfig(const TextDetector::Config &config);
+    void setRegionsOfInterest(const QList<QRect> &regions);
+    // Where the workers count detection and recognition times, set before
+    // the first submit(). Not owned.
+    void setMetrics(PipelineMetrics *metrics) {this->metrics = metrics; };
+
+signals:
+    void textRecognized(quint64 sequence, QString text, QVector<QRect> areas);
+
+private:
+    friend class OcrWorker;
+    bool takeJob(OcrJob &job);
+    bool settingsChanged(int &generation, TextDetector::Config &config, QList<QRect> &regions);
+    // Texts of the frame reference only.
+    bool cachedText(const cv::Rect &area, quint64 reference, QString &text);
+    void storeTexts(quint64 sequence, const std::vector<cv::Rect> &areas,
+                    const std::vector<QString> &texts);
+
+private:
+    TesseractPool *tesseract_pool;
+    QList<OcrWorker*> workers;
+    QList<int> cpu_affinity;
+    QMutex queue_lock;
+    QWaitCondition queue_changed;
+    std::deque<OcrJob> jobs;
+    bool stopping;
+    bool drop_stale;
+    quint64 stale_frames;
+    TextDetector::Config detector_config;
+    QList<QRect> regions_of_interest;
+    int settings_generation;
+    PipelineMetrics *metrics;
+
+    // change gating, only used from the submitting thread
+    ChangeDetector change_detector;
+    bool last_detect_areas;
+    quint64 reference_sequence;     // of the last frame queued
+    quint64 unchanged_frames;
+
+    // texts of the newest recognized frame, by area
+    QMutex cache_lock;
+    quint64 cached_sequence;
+    std::vector<cv::Rect> cached_areas;
+    std::vector<QString> cached_texts;
+};
+
+#endif // OCR_WORKER_H
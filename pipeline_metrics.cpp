@@ -0,0 +1,170 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QStringList>
+#include <QtAlgorithms>
+
+#include "frame_ring.h"
+#include "pipeline_metrics.h"
+
+StageHistogram::StageHistogram():
+    count(0), total(0), max(0)
+{
+    for(int i = 0; i < BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void StageHistogram::record(qint64 duration_us)
+{
+    if(duration_us < 0) {
+        duration_us = 0;
+    }
+    int bucket = duration_us == 0 ? 0 : 64 - qCountLeadingZeroBits((quint64)duration_us);
+    buckets[qMin(bucket, BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(duration_us, std::memory_order_relaxed);
+    qint64 longest = max.load(std::memory_order_relaxed);
+    while(duration_us > longest && !max.compare_exchange_weak(longest, duration_us, std::memory_order_relaxed)) {
+    }
+}
+
+StageHistogram::Snapshot StageHistogram::snapshot() const
+{
+    Snapshot taken;
+    taken.count = count.load(std::memory_order_relaxed);
+    taken.total_us = total.load(std::memory_order_relaxed);
+    taken.max_us = max.load(std::memory_order_relaxed);
+    for(int i = 0; i < BUCKETS; i++) {
+        taken.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+    }
+    return taken;
+}
+
+StageHistogram::Snapshot StageHistogram::Snapshot::since(const Snapshot &before) const
+{
+    Snapshot interval;
+    interval.count = count - before.count;
+    interval.total_us = total_us - before.total_us;
+    interval.max_us = max_us;
+    for(int i = 0; i < BUCKETS; i++) {
+        interval.buckets[i] = buckets[i] - before.buckets[i];
+    }
+    return interval;
+}
+
+double StageHistogram::Snapshot::percentileMs(double fraction) const
+{
+    if(count == 0) {
+        return 0.0;
+    }
+    // the counters are read one by one, their sum may differ from count
+    quint64 total_count = 0;
+    for(int i = 0; i < BUCKETS; i++) {
+        total_count += buckets[i];
+    }
+    quint64 rank = qMax((quint64)1, (quint64)(fraction * total_count + 0.5));
+    quint64 seen = 0;
+    for(int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+        if(seen >= rank) {
+            return i == 0 ? 0.0 : (double)(Q_UINT64_C(1) << i) / 1000.0;
+        }
+    }
+    return max_us / 1000.0;
+}
+
+const char *PipelineMetrics::stageName(int stage)
+{
+    static const char *names[STAGE_COUNT] = {
+        "capture", "motion", "east", "tesseract", "encoding", "display"
+    };
+    return stage >= 0 && stage < STAGE_COUNT ? names[stage] : "";
+}
+
+PipelineMetrics::PipelineMetrics():
+    started(FrameRing::now()), frames(0), dropped(0), recording_dropped(0)
+{
+}
+
+PipelineMetrics::Snapshot PipelineMetrics::snapshot() const
+{
+    Snapshot taken;
+    taken.time = FrameRing::now() - started;
+    taken.frames = frames.load(std::memory_order_relaxed);
+    taken.dropped = dropped.load(std::memory_order_relaxed);
+    taken.recording_dropped = recording_dropped.load(std::memory_order_relaxed);
+    for(int i = 0; i < STAGE_COUNT; i++) {
+        taken.stages[i] = stages[i].snapshot();
+    }
+    return taken;
+}
+
+PipelineMetrics::Snapshot PipelineMetrics::Snapshot::since(const Snapshot &before) const
+{
+    Snapshot interval;
+    interval.time = time - before.time;
+    interval.frames = frames - before.frames;
+    interval.dropped = dropped - before.dropped;
+    interval.recording_dropped = recording_dropped - before.recording_dropped;
+    for(int i = 0; i < STAGE_COUNT; i++) {
+        interval.stages[i] = stages[i].since(before.stages[i]);
+    }
+    return interval;
+}
+
+QString PipelineMetrics::summary(const Snapshot &interval)
+{
+    double seconds = qMax(interval.seconds(), 0.001);
+    QString text = QString("%1 fps").arg(interval.frames / seconds, 0, 'f', 1);
+    if(interval.dropped > 0) {
+        text += QString(", %1 dropped").arg(interval.dropped);
+    }
+    const StageHistogram::Snapshot &display = interval.stages[DISPLAY];
+    if(display.count > 0) {
+        text += QString(", shown %1 fps after %2 ms")
+            .arg(display.count / seconds, 0, 'f', 1).arg(display.meanMs(), 0, 'f', 1);
+    }
+    // reading waits for the camera and display is a latency, neither is
+    // work that could hold the pipeline back
+    int slowest = -1;
+    for(int i = MOTION; i <= ENCODING; i++) {
+        if(interval.stages[i].count > 0
+           && (slowest < 0 || interval.stages[i].meanMs() > interval.stages[slowest].meanMs())) {
+            slowest = i;
+        }
+    }
+    if(slowest >= 0) {
+        text += QString(", slowest %1 %2 ms").arg(stageName(slowest))
+            .arg(interval.stages[slowest].meanMs(), 0, 'f', 1);
+    }
+    return text;
+}
+
+QString PipelineMetrics::report(const Snapshot &snapshot)
+{
+    double seconds = qMax(snapshot.seconds(), 0.001);
+    QStringList lines;
+    lines.append(QString("frames %1 in %2 s (%3 fps), dropped %4, not recorded %5")
+                 .arg(snapshot.frames).arg(seconds, 0, 'f', 1)
+                 .arg(snapshot.frames / seconds, 0, 'f', 1)
+                 .arg(snapshot.dropped).arg(snapshot.recording_dropped));
+    for(int i = 0; i < STAGE_COUNT; i++) {
+        const StageHistogram::Snapshot &stage = snapshot.stages[i];
+        if(stage.count == 0) {
+            continue;
+        }
+        lines.append(QString("%1: %2 frames, mean %3 ms, p50 %4 ms, p95 %5 ms, p99 %6 ms, max %7 ms")
+                     .arg(stageName(i)).arg(stage.count)
+                     .arg(stage.meanMs(), 0, 'f', 2)
+                     .arg(stage.percentileMs(0.50), 0, 'f', 2)
+                     .arg(stage.percentileMs(0.95), 0, 'f', 2)
+                     .arg(stage.percentileMs(0.99), 0, 'f', 2)
+                     .arg(stage.max_us / 1000.0, 0, 'f', 2));
+    }
+    return lines.join('\n');
+}
@@ -0,0 +1,103 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef PIPELINE_METRICS_H
+#define PIPELINE_METRICS_H
+
+#include <atomic>
+#include <QString>
+#include <QtGlobal>
+
+// Durations of one stage, counted in power of two buckets of microseconds:
+// bucket 0 holds 0, bucket i holds [2^(i-1), 2^i). record() only does
+// relaxed atomic adds, so any thread may call it on every frame; snapshots
+// are read while the writers go on and may be off by the frames recorded
+// meanwhile.
+class StageHistogram
+{
+public:
+    static const int BUCKETS = 32;
+
+    StageHistogram();
+    void record(qint64 duration_us);
+
+    struct Snapshot {
+        quint64 count;
+        qint64 total_us;
+        qint64 max_us;      // since the start, not only in an interval
+        quint64 buckets[BUCKETS];
+
+        // What was recorded between before and this snapshot.
+        Snapshot since(const Snapshot &before) const;
+        double meanMs() const {return count ? total_us / 1000.0 / count : 0.0; };
+        // Upper bound of the bucket holding the fraction-th duration, so
+        // within a factor of two of the real percentile.
+        double percentileMs(double fraction) const;
+    };
+    Snapshot snapshot() const;
+
+private:
+    std::atomic<quint64> count;
+    std::atomic<qint64> total;
+    std::atomic<qint64> max;
+    std::atomic<quint64> buckets[BUCKETS];
+};
+
+// Always-on counters of one camera, filled by the threads of its pipeline:
+// capture, motion detection, text detection and recognition, encoding and
+// display. The GUI takes snapshots at its own pace and compares them, so
+// rates and latencies are computed over a rolling interval without ever
+// stopping or slowing down a stage.
+class PipelineMetrics
+{
+public:
+    enum Stage {
+                CAPTURE,    // reading a frame from the source
+                MOTION,     // motion detection and zones
+                EAST,       // text area detection
+                TESSERACT,  // text recognition of a frame
+                ENCODING,   // JPEG encoding of a recorded frame
+                DISPLAY,    // from capture to paint
+                STAGE_COUNT
+    };
+    static const char *stageName(int stage);
+
+    PipelineMetrics();
+    void record(Stage stage, qint64 duration_us) {stages[stage].record(duration_us); };
+    void countFrame() {frames.fetch_add(1, std::memory_order_relaxed); };
+    // A frame the source delivered but the ring had no slot for.
+    void countDrop() {dropped.fetch_add(1, std::memory_order_relaxed); };
+    // A frame the recorder could not queue.
+    void countRecordingDrop() {recording_dropped.fetch_add(1, std::memory_order_relaxed); };
+
+    struct Snapshot {
+        qint64 time;        // microseconds since the metrics were created
+        quint64 frames;
+        quint64 dropped;
+        quint64 recording_dropped;
+        StageHistogram::Snapshot stages[STAGE_COUNT];
+
+        Snapshot since(const Snapshot &before) const;
+        double seconds() const {return time / 1000000.0; };
+    };
+    Snapshot snapshot() const;
+
+    // One line for the status bar, from the difference of two snapshots:
+    // frame rate, drops, display latency and the slowest stage.
+    static QString summary(const Snapshot &interval);
+    // Every counter and stage, one per line.
+    static QString report(const Snapshot &snapshot);
+
+private:
+    qint64 started;
+    std::atomic<quint64> frames;
+    std::atomic<quint64> dropped;
+    std::atomic<quint64> recording_dropped;
+    StageHistogram stages[STAGE_COUNT];
+};
+
+#endif // PIPELINE_METRICS_H
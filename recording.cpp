@@ -0,0 +1,367 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QDebug>
+
+#include "frame_ring.h"
+#include "recording.h"
+#include "utilities.h"
+
+static_assert(sizeof(RecordingIndexHeader) == 32, "index header is 32 bytes");
+static_assert(sizeof(RecordingIndexEntry) == 32, "index entries are 32 bytes");
+
+SegmentWriter::SegmentWriter():
+    data_fd(-1), index_fd(-1), channels(0), frames(0), offset(0), first_timestamp(0)
+{
+}
+
+SegmentWriter::~SegmentWriter()
+{
+    close();
+}
+
+bool SegmentWriter::open(const QString &path_base, int segment, cv::Size size, int channels)
+{
+    close();
+    base = path_base;
+    data_fd = ::open(dataPath(base).toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    index_fd = ::open(indexPath(base).toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    RecordingIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "HSKIDX1", 8);
+    header.record_size = sizeof(RecordingIndexEntry);
+    header.segment = segment;
+    header.width = size.width;
+    header.height = size.height;
+    header.channels = channels;
+    // wall clock at steady clock zero, for frame timestamps to be dated
+    header.clock_origin = (quint32)((QDateTime::currentMSecsSinceEpoch() * 1000
+                                     - FrameRing::now() + 500000) / 1000000);
+    if(data_fd < 0 || index_fd < 0 || !writeAll(index_fd, &header, sizeof(header))) {
+        qDebug() << "Cannot create recording" << base << strerror(errno);
+        discard();
+        return false;
+    }
+    this->size = size;
+    this->channels = channels;
+    frames = 0;
+    offset = 0;
+    first_timestamp = 0;
+    return true;
+}
+
+bool SegmentWriter::rename(const QString &path_base, int segment)
+{
+    // the descriptors stay valid, the files just change names
+    if(std::rename(dataPath(base).toLocal8Bit().constData(), dataPath(path_base).toLocal8Bit().constData()) != 0
+       || std::rename(indexPath(base).toLocal8Bit().constData(), indexPath(path_base).toLocal8Bit().constData()) != 0) {
+        return false;
+    }
+    base = path_base;
+    quint32 number = segment;
+    return pwrite(index_fd, &number, sizeof(number), offsetof(RecordingIndexHeader, segment)) == sizeof(number);
+}
+
+bool SegmentWriter::writeAll(int fd, const void *buffer, size_t length)
+{
+    const char *bytes = (const char *)buffer;
+    while(length > 0) {
+        ssize_t count = ::write(fd, bytes, length);
+        if(count < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += count;
+        length -= count;
+    }
+    return true;
+}
+
+bool SegmentWriter::write(const std::vector<uchar> &jpeg, quint32 flags, quint64 sequence, qint64 timestamp)
+{
+    if(!writeAll(data_fd, jpeg.data(), jpeg.size())) {
+        rollBack();
+        return false;
+    }
+    RecordingIndexEntry entry;
+    entry.offset = offset;
+    entry.size = jpeg.size();
+    entry.flags = flags;
+    entry.sequence = sequence;
+    entry.timestamp = timestamp;
+    // only now, the image it points to is complete
+    if(!writeAll(index_fd, &entry, sizeof(entry))) {
+        rollBack();
+        return false;
+    }
+    if(frames++ == 0) {
+        first_timestamp = timestamp;
+    }
+    offset += jpeg.size();
+    return true;
+}
+
+void SegmentWriter::rollBack()
+{
+    // a partial image would shift every following one away from its entry
+    off_t index_end = sizeof(RecordingIndexHeader) + (off_t)frames * sizeof(RecordingIndexEntry);
+    if(ftruncate(data_fd, offset) != 0 || lseek(data_fd, offset, SEEK_SET) < 0
+       || ftruncate(index_fd, index_end) != 0 || lseek(index_fd, index_end, SEEK_SET) < 0) {
+        qDebug() << "Cannot undo a failed write to" << base << strerror(errno);
+        close();
+    }
+}
+
+void SegmentWriter::close()
+{
+    if(data_fd >= 0) {
+        fsync(data_fd);
+        ::close(data_fd);
+        data_fd = -1;
+    }
+    if(index_fd >= 0) {
+        fsync(index_fd);
+        ::close(index_fd);
+        index_fd = -1;
+    }
+}
+
+void SegmentWriter::discard()
+{
+    // a closed segment is complete, it is not ours to delete
+    if(data_fd < 0 && index_fd < 0) {
+        return;
+    }
+    if(data_fd >= 0) {
+        ::close(data_fd);
+        data_fd = -1;
+    }
+    if(index_fd >= 0) {
+        ::close(index_fd);
+        index_fd = -1;
+    }
+    std::remove(dataPath(base).toLocal8Bit().constData());
+    std::remove(indexPath(base).toLocal8Bit().constData());
+}
+
+// <name>.<NNN>.idx or <name>.<NNN>.mjpg
+static const QRegularExpression segment_file("^(.*)\\.\\d{3}\\.(idx|mjpg)$");
+
+RecordingReader::RecordingReader():
+    frames(0), clock_origin(0)
+{
+}
+
+RecordingReader::~RecordingReader()
+{
+    close();
+}
+
+bool RecordingReader::isRecording(const QString &path)
+{
+    return segment_file.match(path).hasMatch();
+}
+
+QStringList RecordingReader::find(const QString &directory)
+{
+    QDir dir(directory);
+    QStringList names;
+    for(const QString &file : dir.entryList(QStringList() << "*.000.idx", QDir::Files, QDir::Name)) {
+        names << dir.absoluteFilePath(file.left(file.size() - 8));
+    }
+    return names;
+}
+
+bool RecordingReader::open(const QString &path)
+{
+    close();
+    QRegularExpressionMatch match = segment_file.match(path);
+    base = match.hasMatch() ? match.captured(1) : path;
+    if(QFileInfo(base).isRelative() && !QFileInfo::exists(SegmentWriter::indexPath(base + ".000"))) {
+        base = QDir(Utilities::getDataPath()).absoluteFilePath(base);
+    }
+    // segments are numbered without gaps, the first missing one ends it
+    for(int number = 0; ; number++) {
+        Segment segment;
+        if(!mapSegment(QString("%1.%2").arg(base).arg(number, 3, 10, QChar('0')), segment)) {
+            break;
+        }
+        segment.first = frames;
+        segments.push_back(segment);
+        frames += segment.count;
+    }
+    if(frames == 0) {
+        qDebug() << "No recorded frames in" << base;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool RecordingReader::mapSegment(const QString &path_base, Segment &segment)
+{
+    int data_fd = ::open(SegmentWriter::dataPath(path_base).toLocal8Bit().constData(), O_RDONLY);
+    int index_fd = ::open(SegmentWriter::indexPath(path_base).toLocal8Bit().constData(), O_RDONLY);
+    struct stat data_stat, index_stat;
+    bool ok = data_fd >= 0 && index_fd >= 0
+        && fstat(data_fd, &data_stat) == 0 && fstat(index_fd, &index_stat) == 0
+        && (size_t)index_stat.st_size >= sizeof(RecordingIndexHeader);
+    segment.data = nullptr;
+    segment.data_size = ok ? data_stat.st_size : 0;
+    segment.index = nullptr;
+    segment.index_size = ok ? index_stat.st_size : 0;
+    if(ok && segment.data_size > 0) {
+        void *data = mmap(nullptr, segment.data_size, PROT_READ, MAP_SHARED, data_fd, 0);
+        segment.data = data == MAP_FAILED ? nullptr : (const uchar *)data;
+        ok = segment.data != nullptr;
+    }
+    if(ok) {
+        void *index = mmap(nullptr, segment.index_size, PROT_READ, MAP_SHARED, index_fd, 0);
+        segment.index = index == MAP_FAILED ? nullptr : (const uchar *)index;
+        ok = segment.index != nullptr;
+    }
+    // the mappings stay valid without the descriptors
+    if(data_fd >= 0) {
+        ::close(data_fd);
+    }
+    if(index_fd >= 0) {
+        ::close(index_fd);
+    }
+
+    const RecordingIndexHeader *header = (const RecordingIndexHeader *)segment.index;
+    if(ok && (std::memcmp(header->magic, "HSKIDX1", 8) != 0
+              || header->record_size < sizeof(RecordingIndexEntry) || header->record_size % 8 != 0)) {
+        qDebug() << "Not a recording index" << SegmentWriter::indexPath(path_base);
+        ok = false;
+    }
+    if(!ok) {
+        if(segment.data != nullptr) {
+            munmap((void *)segment.data, segment.data_size);
+        }
+        if(segment.index != nullptr) {
+            munmap((void *)segment.index, segment.index_size);
+        }
+        return false;
+    }
+    if(segments.empty()) {
+        size = cv::Size(header->width, header->height);
+        clock_origin = header->clock_origin;
+    }
+    segment.record_size = header->record_size;
+    // a partial entry at the end is left out, so is an entry whose image
+    // is not all there, which only a damaged file can have
+    segment.count = (segment.index_size - sizeof(RecordingIndexHeader)) / segment.record_size;
+    while(segment.count > 0) {
+        const RecordingIndexEntry *last = (const RecordingIndexEntry *)(segment.index
+            + sizeof(RecordingIndexHeader) + (size_t)(segment.count - 1) * segment.record_size);
+        if(last->offset + last->size <= segment.data_size) {
+            break;
+        }
+        segment.count--;
+    }
+    return true;
+}
+
+void RecordingReader::close()
+{
+    for(const Segment &segment : segments) {
+        if(segment.data != nullptr) {
+            munmap((void *)segment.data, segment.data_size);
+        }
+        munmap((void *)segment.index, segment.index_size);
+    }
+    segments.clear();
+    frames = 0;
+    clock_origin = 0;
+}
+
+const RecordingReader::Segment &RecordingReader::segmentOf(int frame) const
+{
+    // the last segment starting at or before frame
+    auto it = std::upper_bound(segments.begin(), segments.end(), frame,
+                               [](int frame, const Segment &segment) { return frame < segment.first; });
+    return *(it - 1);
+}
+
+const RecordingIndexEntry &RecordingReader::entry(int frame) const
+{
+    const Segment &segment = segmentOf(frame);
+    return *(const RecordingIndexEntry *)(segment.index + sizeof(RecordingIndexHeader)
+                                          + (size_t)(frame - segment.first) * segment.record_size);
+}
+
+int RecordingReader::findTimestamp(qint64 timestamp) const
+{
+    // entries are sorted by time, so a binary search over the frame numbers
+    int first = 0, count = frames;
+    while(count > 0) {
+        int half = count / 2;
+        if(entry(first + half).timestamp < timestamp) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+int RecordingReader::findSequence(quint64 sequence) const
+{
+    // the ring numbers frames in capture order, so they are sorted as well
+    int first = 0, count = frames;
+    while(count > 0) {
+        int half = count / 2;
+        if(entry(first + half).sequence < sequence) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first < frames && entry(first).sequence == sequence ? first : -1;
+}
+
+bool RecordingReader::readFrame(int frame, cv::Mat &image) const
+{
+    if(frame < 0 || frame >= frames) {
+        return false;
+    }
+    const Segment &segment = segmentOf(frame);
+    const RecordingIndexEntry &item = entry(frame);
+    // only the last entry is checked when mapping, a damaged index could
+    // point any other one outside the data
+    if(item.size == 0 || item.offset > segment.data_size || item.size > segment.data_size - item.offset) {
+        return false;
+    }
+    // decoded straight from the mapping, without a copy
+    cv::Mat jpeg(1, (int)item.size, CV_8UC1, (void *)(segment.data + item.offset));
+    cv::imdecode(jpeg, cv::IMREAD_UNCHANGED, &image);
+    return !image.empty();
+}
+
+QDateTime RecordingReader::wallClock(int frame) const
+{
+    if(clock_origin == 0 || frame < 0 || frame >= frames) {
+        return QDateTime();
+    }
+    return QDateTime::fromMSecsSinceEpoch((qint64)clock_origin * 1000 + entry(frame).timestamp / 1000);
+}
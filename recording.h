@@ -0,0 +1,161 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <vector>
+#include <QDateTime>
+#include <QString>
+#include <QStringList>
+
+#include "opencv2/opencv.hpp"
+
+// Recordings are split in segments of fixed duration. A segment is a pair of
+// files next to each other under Utilities::getDataPath():
+//
+//     <name>.<NNN>.mjpg   the JPEG images of the frames, back to back
+//     <name>.<NNN>.idx    a RecordingIndexHeader, then one
+//                         RecordingIndexEntry per frame
+//
+// Every integer is little endian. Entries have a fixed size, so frame n is
+// found at sizeof(RecordingIndexHeader) + n * record_size without reading
+// the others, and they are sorted by timestamp. An entry is only appended
+// once its image is completely written, so after a crash each entry of the
+// last segment still points to a whole JPEG; a trailing partial entry is
+// ignored by readers. Timestamps come from the steady clock of FrameRing;
+// clock_origin gives the wall clock time of its zero, to the second.
+struct RecordingIndexHeader
+{
+    char magic[8];          // "HSKIDX1", zero terminated
+    quint32 record_size;    // sizeof(RecordingIndexEntry) of the writer
+    quint32 segment;        // number of the segment in the recording
+    quint32 width;
+    quint32 height;
+    quint32 channels;       // 3 for color, 1 for gray
+    quint32 clock_origin;   // seconds since 1970 UTC at timestamp 0, 0 if unknown
+};
+
+struct RecordingIndexEntry
+{
+    enum Flags {
+                MOTION = 1,     // motion was detected in the frame
+                PRE_ROLL = 2,   // kept from before the event started
+                EVENT_START = 4 // first frame captured after the event started
+    };
+    quint64 offset;         // of the JPEG in the .mjpg file
+    quint32 size;
+    quint32 flags;
+    quint64 sequence;       // frame sequence number of the capture ring
+    qint64 timestamp;       // capture time, see FrameRing::now()
+};
+
+// Writes one segment. Every frame goes straight to the kernel, so what was
+// written survives a crash of the process; close() also syncs it to disk.
+// A frame that fails to be written is cut off again; if that fails too the
+// segment is closed with the frames before it.
+class SegmentWriter
+{
+public:
+    SegmentWriter();
+    ~SegmentWriter();
+
+    // path_base is the path without the extensions.
+    bool open(const QString &path_base, int segment, cv::Size size, int channels);
+    bool isOpen() const { return data_fd >= 0; };
+    // Moves the open files to another path_base, as the given segment.
+    bool rename(const QString &path_base, int segment);
+    bool write(const std::vector<uchar> &jpeg, quint32 flags, quint64 sequence, qint64 timestamp);
+    void close();
+    // Closes and deletes the files, if they are still open.
+    void discard();
+
+    cv::Size frameSize() const { return size; };
+    int frameChannels() const { return channels; };
+    int frameCount() const { return frames; };
+    qint64 firstTimestamp() const { return first_timestamp; };
+
+    static QString dataPath(const QString &path_base) { return path_base + ".mjpg"; };
+    static QString indexPath(const QString &path_base) { return path_base + ".idx"; };
+
+private:
+    bool writeAll(int fd, const void *buffer, size_t length);
+    void rollBack();
+
+private:
+    QString base;
+    int data_fd;
+    int index_fd;
+    cv::Size size;
+    int channels;
+    int frames;
+    quint64 offset;
+    qint64 first_timestamp;
+};
+
+// Random access to a whole recording. Every segment is memory mapped, so a
+// frame is found from its index entry and only its own JPEG is decoded;
+// nothing is read from disk that is not needed. Frames are numbered from 0
+// across the segments. The reader is not changed by reads, so any number of
+// threads can read frames at the same time.
+class RecordingReader
+{
+public:
+    RecordingReader();
+    ~RecordingReader();
+
+    // path is the name of the recording, with or without the data path, or
+    // any of its segment files.
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const { return frames > 0; };
+
+    QString name() const { return base; };
+    int frameCount() const { return frames; };
+    int segmentCount() const { return (int)segments.size(); };
+    cv::Size frameSize() const { return size; };
+    const RecordingIndexEntry &entry(int frame) const;
+    qint64 startTime() const { return entry(0).timestamp; };
+    qint64 endTime() const { return entry(frames - 1).timestamp; };
+
+    // First frame recorded at or after timestamp, frameCount() if none.
+    int findTimestamp(qint64 timestamp) const;
+    // Frame with the given ring sequence number, -1 if it was not recorded.
+    int findSequence(quint64 sequence) const;
+    // Decodes one frame, BGR or gray as recorded, reusing the buffer of image.
+    bool readFrame(int frame, cv::Mat &image) const;
+    // When a frame was captured, invalid for recordings without clock_origin.
+    QDateTime wallClock(int frame) const;
+
+    // True for the segment files of a recording.
+    static bool isRecording(const QString &path);
+    // Recordings found in directory, by name.
+    static QStringList find(const QString &directory);
+
+private:
+    struct Segment {
+        const uchar *data;
+        size_t data_size;
+        const uchar *index;
+        size_t index_size;
+        quint32 record_size;
+        int first;          // number of its first frame in the recording
+        int count;
+    };
+
+    bool mapSegment(const QString &path_base, Segment &segment);
+    const Segment &segmentOf(int frame) const;
+
+private:
+    QString base;
+    std::vector<Segment> segments;
+    int frames;
+    cv::Size size;
+    quint32 clock_origin;
+};
+
+#endif // RECORDING_H
@@ -0,0 +1,117 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QApplication>
+#include <QDesktopWidget>
+#include <QPainter>
+#include <QColor>
+#include <QRegion>
+#include <QShortcut>
+
+#include "roiselector.h"
+
+RoiSelector::RoiSelector(QPixmap frame, QList<QRect> regions, QWidget *parent):
+    QWidget(parent, Qt::Window), frame(frame), scale(1.0), regions(regions), mouseDown(false)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    setWindowTitle("Regions of interest: drag to add, Backspace to undo, Return to save");
+
+    // fit large frames on the screen, regions are kept in frame coordinates
+    QRect available = QApplication::desktop()->availableGeometry(this);
+    QSize size = frame.size();
+    if(size.width() > available.width() * 0.9 || size.height() > available.height() * 0.9) {
+        size.scale(available.size() * 0.9, Qt::KeepAspectRatio);
+        scale = (qreal)size.width() / frame.width();
+    }
+    scaled = frame.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    setFixedSize(scaled.size());
+    initShortcuts();
+}
+
+RoiSelector::~RoiSelector() {
+}
+
+void RoiSelector::paintEvent(QPaintEvent*) {
+    QPainter painter(this);
+    painter.drawPixmap(0, 0, scaled);
+
+    QRegion grey(rect());
+    painter.setPen(QColor(50, 100, 200, 255));
+    for(const QRect &region : regions) {
+        QRect shown = toWidget(region);
+        painter.drawRect(shown);
+        grey = grey.subtracted(shown);
+    }
+    if(p1.x() != p2.x() && p1.y() != p2.y()) {
+        painter.setPen(QColor(200, 100, 50, 255));
+        painter.drawRect(QRect(p1, p2).normalized());
+        grey = grey.subtracted(QRect(p1, p2).normalized());
+    }
+    painter.setClipRegion(grey);
+    QColor overlayColor(20, 20, 20, 50);
+    painter.fillRect(rect(), overlayColor);
+    painter.setClipRect(rect());
+}
+
+void RoiSelector::mousePressEvent(QMouseEvent *event)
+{
+    mouseDown = true;
+    p1 = event->pos();
+    p2 = event->pos();
+    update();
+}
+
+void RoiSelector::mouseMoveEvent(QMouseEvent *event)
+{
+    if(!mouseDown) return;
+    p2 = event->pos();
+    update();
+}
+
+void RoiSelector::mouseReleaseEvent(QMouseEvent *event)
+{
+    mouseDown = false;
+    p2 = event->pos();
+    QRect region = toFrame(QRect(p1, p2).normalized()) & frame.rect();
+    if(region.width() > 1 && region.height() > 1) {
+        regions.append(region);
+    }
+    p1 = p2;
+    update();
+}
+
+void RoiSelector::confirmSelection()
+{
+    emit regionsSelected(regions);
+    close();
+}
+
+void RoiSelector::removeLast()
+{
+    if(!regions.isEmpty()) {
+        regions.removeLast();
+        update();
+    }
+}
+
+void RoiSelector::initShortcuts() {
+    new QShortcut(Qt::Key_Escape, this, SLOT(close()));
+    new QShortcut(Qt::Key_Return, this, SLOT(confirmSelection()));
+    new QShortcut(Qt::Key_Backspace, this, SLOT(removeLast()));
+}
+
+QRect RoiSelector::toFrame(const QRect &rect) const
+{
+    return QRect(qRound(rect.x() / scale), qRound(rect.y() / scale),
+                 qRound(rect.width() / scale), qRound(rect.height() / scale));
+}
+
+QRect RoiSelector::toWidget(const QRect &rect) const
+{
+    return QRect(qRound(rect.x() * scale), qRound(rect.y() * scale),
+                 qRound(rect.width() * scale), qRound(rect.height() * scale));
+}
@@ -0,0 +1,56 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef ROISELECTOR_H
+#define ROISELECTOR_H
+
+#include <QWidget>
+#include <QPixmap>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QPoint>
+#include <QRect>
+#include <QList>
+
+// Lets the user draw the regions of interest over a frame, the same way
+// ScreenCapturer selects the area to capture. Every drag adds a region;
+// Return confirms, Backspace removes the last region and Escape cancels.
+class RoiSelector : public QWidget {
+    Q_OBJECT
+
+public:
+    RoiSelector(QPixmap frame, QList<QRect> regions, QWidget *parent = nullptr);
+    ~RoiSelector();
+
+signals:
+    void regionsSelected(QList<QRect> regions);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+
+private slots:
+    void confirmSelection();
+    void removeLast();
+
+private:
+    void initShortcuts();
+    QRect toFrame(const QRect &rect) const;
+    QRect toWidget(const QRect &rect) const;
+
+private:
+    QPixmap frame;
+    QPixmap scaled;
+    qreal scale;
+    QList<QRect> regions;
+    QPoint p1, p2;
+    bool mouseDown;
+};
+
+#endif // ROISELECTOR_H
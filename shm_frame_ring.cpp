@@ -0,0 +1,272 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <climits>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <QDebug>
+
+#include "shm_frame_ring.h"
+
+static const char ring_magic[8] = {'H', 'S', 'K', 'R', 'I', 'N', 'G', '1'};
+
+// Shared (not private) futex operations, the word lives in memory mapped by
+// several processes.
+static void futexWakeAll(std::atomic<quint32> *word)
+{
+    syscall(SYS_futex, (quint32 *)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static void futexWait(const std::atomic<quint32> *word, quint32 value, int timeout_ms)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall(SYS_futex, (const quint32 *)word, FUTEX_WAIT, value,
+            timeout_ms < 0 ? nullptr : &timeout, nullptr, 0);
+}
+
+static size_t roundUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static int cvType(quint32 format)
+{
+    return format == SHM_GRAY8 ? CV_8UC1 : CV_8UC3;
+}
+
+ShmFrameWriter::ShmFrameWriter(QString name, int slot_count):
+    name(name), slot_count(qMax(2, slot_count)), header(nullptr), mapped_size(0),
+    published(0), dropped(0)
+{
+}
+
+ShmFrameWriter::~ShmFrameWriter()
+{
+    if(header != nullptr) {
+        munmap(header, mapped_size);
+        shm_unlink(name.toLocal8Bit().constData());
+    }
+}
+
+bool ShmFrameWriter::open(const cv::Mat &frame, ShmPixelFormat format)
+{
+    QByteArray path = name.toLocal8Bit();
+    // a segment left by an earlier writer may still be mapped by readers:
+    // shrinking it would make them fault, so it is unlinked and a new one
+    // is created, which they reopen by name
+    shm_unlink(path.constData());
+    int fd = shm_open(path.constData(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) {
+        qDebug() << "Cannot create shared memory" << name << strerror(errno);
+        return false;
+    }
+    // rows start on cache lines, slots on pages
+    size_t stride = roundUp(frame.cols * frame.elemSize(), 64);
+    size_t slot_size = roundUp(sizeof(ShmSlotHeader) + stride * frame.rows, 4096);
+    size_t data_offset = roundUp(sizeof(ShmRingHeader), 4096);
+    mapped_size = data_offset + slot_size * slot_count;
+    if(ftruncate(fd, mapped_size) != 0) {
+        qDebug() << "Cannot size shared memory" << name << strerror(errno);
+        ::close(fd);
+        shm_unlink(path.constData());
+        return false;
+    }
+    void *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(memory == MAP_FAILED) {
+        qDebug() << "Cannot map shared memory" << name << strerror(errno);
+        shm_unlink(path.constData());
+        return false;
+    }
+
+    // the segment is zero filled, so every seqlock starts even
+    header = new (memory) ShmRingHeader;
+    header->slot_count = slot_count;
+    header->width = frame.cols;
+    header->height = frame.rows;
+    header->stride = stride;
+    header->format = format;
+    header->slot_size = slot_size;
+    header->data_offset = data_offset;
+    header->frame_counter.store(0, std::memory_order_relaxed);
+    header->latest.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, ring_magic, sizeof(ring_magic));
+    return true;
+}
+
+bool ShmFrameWriter::publish(const cv::Mat &frame, ShmPixelFormat format, quint64 sequence, qint64 timestamp)
+{
+    if(header == nullptr && !open(frame, format)) {
+        return false;
+    }
+    size_t row_size = frame.cols * frame.elemSize();
+    if(row_size > header->stride || (quint32)frame.rows > header->height) {
+        dropped++;
+        return false;
+    }
+
+    uchar *base = (uchar *)header + header->data_offset + header->slot_size * (sequence % slot_count);
+    ShmSlotHeader *slot = (ShmSlotHeader *)base;
+    uchar *pixels = base + sizeof(ShmSlotHeader);
+    quint32 lock = slot->seqlock.load(std::memory_order_relaxed);
+    slot->seqlock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->width = frame.cols;
+    slot->height = frame.rows;
+    slot->stride = header->stride;
+    slot->format = format;
+    slot->sequence = sequence;
+    slot->timestamp = timestamp;
+    for(int y = 0; y < frame.rows; y++) {
+        std::memcpy(pixels + y * header->stride, frame.ptr(y), row_size);
+    }
+    slot->seqlock.store(lock + 2, std::memory_order_release);
+
+    header->latest.store(sequence + 1, std::memory_order_release);
+    header->frame_counter.fetch_add(1, std::memory_order_release);
+    futexWakeAll(&header->frame_counter);
+    published++;
+    return true;
+}
+
+ShmFrameReader::ShmFrameReader(QString name):
+    name(name), header(nullptr), mapped_size(0)
+{
+}
+
+ShmFrameReader::~ShmFrameReader()
+{
+    close();
+}
+
+bool ShmFrameReader::open()
+{
+    int fd = shm_open(name.toLocal8Bit().constData(), O_RDONLY, 0);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ShmRingHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(memory == MAP_FAILED) {
+        return false;
+    }
+    const ShmRingHeader *mapped = (const ShmRingHeader *)memory;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(std::memcmp(mapped->magic, ring_magic, sizeof(ring_magic)) != 0
+       || mapped->slot_count == 0
+       || mapped->data_offset + mapped->slot_size * mapped->slot_count > (quint64)info.st_size
+       || sizeof(ShmSlotHeader) + (quint64)mapped->stride * mapped->height > mapped->slot_size) {
+        munmap(memory, info.st_size);
+        return false;
+    }
+    header = mapped;
+    mapped_size = info.st_size;
+    return true;
+}
+
+void ShmFrameReader::close()
+{
+    if(header != nullptr) {
+        munmap((void *)header, mapped_size);
+        header = nullptr;
+    }
+}
+
+bool ShmFrameReader::waitForFrame(quint64 sequence, int timeout_ms) const
+{
+    quint64 newest;
+    for(;;) {
+        quint32 counter = header->frame_counter.load(std::memory_order_acquire);
+        if(latestSequence(newest) && newest > sequence) {
+            return true;
+        }
+        futexWait(&header->frame_counter, counter, timeout_ms);
+        if(timeout_ms >= 0) {
+            // a single wait, the caller decides whether to try again
+            return latestSequence(newest) && newest > sequence;
+        }
+    }
+}
+
+bool ShmFrameReader::latestSequence(quint64 &sequence) const
+{
+    quint64 latest = header->latest.load(std::memory_order_acquire);
+    if(latest == 0) {
+        return false;
+    }
+    sequence = latest - 1;
+    return true;
+}
+
+bool ShmFrameReader::latest(View &view) const
+{
+    quint64 sequence;
+    if(!latestSequence(sequence)) {
+        return false;
+    }
+    const uchar *base = (const uchar *)header + header->data_offset
+        + header->slot_size * (sequence % header->slot_count);
+    const ShmSlotHeader *slot = (const ShmSlotHeader *)base;
+    quint32 lock = slot->seqlock.load(std::memory_order_acquire);
+    if(lock & 1) {
+        return false;
+    }
+    view.slot = slot;
+    view.lock = lock;
+    view.format = (ShmPixelFormat)slot->format;
+    view.sequence = slot->sequence;
+    view.timestamp = slot->timestamp;
+    quint32 width = slot->width, height = slot->height, stride = slot->stride;
+    // a torn or bad slot header must not make the image reach past the slot
+    if(!stillValid(view) || height > header->height || width > header->width
+       || stride != header->stride
+       || (view.format != SHM_GRAY8 && view.format != SHM_RGB24 && view.format != SHM_BGR24)
+       || (quint64)width * (view.format == SHM_GRAY8 ? 1 : 3) > stride) {
+        return false;
+    }
+    view.image = cv::Mat(height, width, cvType(view.format),
+                         (void *)(base + sizeof(ShmSlotHeader)), stride);
+    return true;
+}
+
+bool ShmFrameReader::stillValid(const View &view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.slot->seqlock.load(std::memory_order_relaxed) == view.lock;
+}
+
+bool ShmFrameReader::copyLatest(cv::Mat &frame, quint64 &sequence, qint64 &timestamp) const
+{
+    for(int attempt = 0; attempt < 4; attempt++) {
+        View view;
+        if(!latest(view)) {
+            continue;
+        }
+        view.image.copyTo(frame);
+        if(stillValid(view)) {
+            sequence = view.sequence;
+            timestamp = view.timestamp;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,116 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef SHM_FRAME_RING_H
+#define SHM_FRAME_RING_H
+
+#include <atomic>
+#include <QtGlobal>
+#include <QString>
+
+#include "opencv2/opencv.hpp"
+
+// Frames published to other local processes through POSIX shared memory.
+//
+// The segment starts with a ShmRingHeader, followed at data_offset by
+// slot_count slots of slot_size bytes, each a ShmSlotHeader and the pixels.
+// The writer fills slot sequence % slot_count under the seqlock of the slot
+// (odd while writing), then bumps frame_counter and wakes the futex on it.
+// Readers map the segment read-only, wait on frame_counter and check the
+// seqlock before and after using the pixels, so any number of them can read
+// a frame in place without copying it. A new writer replaces the segment
+// instead of resizing it; readers of the old one see no new frames and
+// reopen it by name.
+enum ShmPixelFormat {
+                     SHM_GRAY8 = 1,
+                     SHM_RGB24 = 2,
+                     SHM_BGR24 = 3
+};
+
+struct ShmRingHeader
+{
+    char magic[8];                      // "HSKRING1", written last
+    quint32 slot_count;
+    quint32 width, height, stride;      // of the frames the segment was sized for
+    quint32 format;                     // ShmPixelFormat
+    quint64 slot_size;
+    quint64 data_offset;
+    alignas(64) std::atomic<quint32> frame_counter;    // futex word
+    std::atomic<quint64> latest;        // sequence of the newest frame + 1, 0 before the first
+};
+
+struct alignas(64) ShmSlotHeader
+{
+    std::atomic<quint32> seqlock;
+    quint32 width, height, stride;
+    quint32 format;
+    quint64 sequence;
+    qint64 timestamp;                   // see FrameRing::now()
+};
+
+class ShmFrameWriter
+{
+public:
+    explicit ShmFrameWriter(QString name, int slot_count = 8);
+    // Unmaps and unlinks the segment, mapped readers keep their view.
+    ~ShmFrameWriter();
+
+    // Creates the segment, sized for frames like frame.
+    bool open(const cv::Mat &frame, ShmPixelFormat format);
+    bool isOpen() const { return header != nullptr; };
+    // Frames larger than the one the segment was sized for are dropped.
+    bool publish(const cv::Mat &frame, ShmPixelFormat format, quint64 sequence, qint64 timestamp);
+    quint64 publishedFrames() const { return published; };
+    quint64 droppedFrames() const { return dropped; };
+
+private:
+    QString name;
+    int slot_count;
+    ShmRingHeader *header;
+    size_t mapped_size;
+    quint64 published;
+    quint64 dropped;
+};
+
+class ShmFrameReader
+{
+public:
+    // A frame used in place. image points into the segment and may be
+    // overwritten by the writer at any time; results computed from it are
+    // only good if stillValid() holds afterwards.
+    struct View {
+        cv::Mat image;
+        ShmPixelFormat format;
+        quint64 sequence;
+        qint64 timestamp;
+        const ShmSlotHeader *slot;
+        quint32 lock;
+    };
+
+    explicit ShmFrameReader(QString name);
+    ~ShmFrameReader();
+
+    bool open();
+    void close();
+    bool isOpen() const { return header != nullptr; };
+
+    // Waits for a frame newer than sequence, timeout_ms < 0 waits forever.
+    bool waitForFrame(quint64 sequence, int timeout_ms = -1) const;
+    // Sequence of the newest frame, false before the first one.
+    bool latestSequence(quint64 &sequence) const;
+    bool latest(View &view) const;
+    bool stillValid(const View &view) const;
+    // Copies the newest frame, retrying while the writer overtakes the copy.
+    bool copyLatest(cv::Mat &frame, quint64 &sequence, qint64 &timestamp) const;
+
+private:
+    QString name;
+    const ShmRingHeader *header;
+    size_t mapped_size;
+};
+
+#endif // SHM_FRAME_RING_H
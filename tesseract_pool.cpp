@@ -0,0 +1,185 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <QThread>
+#include <QtConcurrent>
+#include <QDebug>
+
+#include "utilities.h"
+#include "tesseract_pool.h"
+
+TesseractPool::TesseractPool(int size, const QList<int> &cpus):
+    cpu_affinity(cpus)
+{
+    if(size <= 0) {
+        size = cpus.isEmpty() ? QThread::idealThreadCount() : cpus.size();
+    }
+
+    // Tesseract needs the C locale while it is created and initialized
+    char *old_ctype = strdup(setlocale(LC_ALL, NULL));
+    setlocale(LC_ALL, "C");
+    for(int i = 0; i < size; i++) {
+        tesseract::TessBaseAPI *api = new tesseract::TessBaseAPI();
+        // Initialize tesseract-ocr with English, with specifying tessdata path
+        if (api->Init(TESSDATA_PREFIX, "eng")) {
+            qDebug() << "Tesseract could not be initialized.";
+            delete api;
+            break;
+        }
+        instances.append(api);
+    }
+    setlocale(LC_ALL, old_ctype);
+    free(old_ctype);
+    idle = instances;
+    // keep the threads, they are pinned only once
+    threads.setMaxThreadCount(qMax(1, instances.size()));
+    threads.setExpiryTimeout(-1);
+}
+
+TesseractPool::~TesseractPool()
+{
+    threads.waitForDone();
+    for(tesseract::TessBaseAPI *api : instances) {
+        api->End();
+        delete api;
+    }
+}
+
+QString TesseractPool::recognizeAreas(const cv::Mat &image, std::vector<cv::Rect> &areas)
+{
+    if(!isReady()) {
+        return QString();
+    }
+    sortReadingOrder(areas);
+    return joinTexts(recognizeEach(image, areas));
+}
+
+std::vector<QString> TesseractPool::recognizeEach(const cv::Mat &image, const std::vector<cv::Rect> &areas)
+{
+    std::vector<QString> texts(areas.size());
+    if(!isReady()) {
+        return texts;
+    }
+    std::vector<QFuture<void>> futures;
+    futures.reserve(areas.size());
+    for(size_t i = 0; i < areas.size(); i++) {
+        futures.push_back(QtConcurrent::run(&threads, [&, i]() {
+            pinThread();
+            tesseract::TessBaseAPI *api = acquire();
+            texts[i] = recognizeArea(api, image, areas[i]);
+            release(api);
+        }));
+    }
+    for(QFuture<void> &future : futures) {
+        future.waitForFinished();
+    }
+    return texts;
+}
+
+QString TesseractPool::recognizeAreas(tesseract::TessBaseAPI *api, const cv::Mat &image,
+                                      std::vector<cv::Rect> &areas)
+{
+    sortReadingOrder(areas);
+    std::vector<QString> texts(areas.size());
+    for(size_t i = 0; i < areas.size(); i++) {
+        texts[i] = recognizeArea(api, image, areas[i]);
+    }
+    return joinTexts(texts);
+}
+
+void TesseractPool::setImage(tesseract::TessBaseAPI *api, const cv::Mat &image, const cv::Rect &rect)
+{
+    if(image.channels() == 1) {
+        api->SetImage(image.ptr(rect.y, rect.x), rect.width, rect.height, 1, image.step);
+        return;
+    }
+    // SetImage() copies the pixels, the gray crop can go right after
+    cv::Mat gray;
+    cv::cvtColor(image(rect), gray, cv::COLOR_BGR2GRAY);
+    api->SetImage(gray.data, gray.cols, gray.rows, 1, gray.step);
+}
+
+QString TesseractPool::recognizeArea(tesseract::TessBaseAPI *api, const cv::Mat &image,
+                                     const cv::Rect &area)
+{
+    cv::Rect rect = area & cv::Rect(0, 0, image.cols, image.rows);
+    if(rect.empty()) {
+        return QString();
+    }
+    // hand Tesseract only the crop, not a copy of the whole frame
+    setImage(api, image, rect);
+    char *outText = api->GetUTF8Text();
+    QString text = QString::fromUtf8(outText);
+    delete [] outText;
+    return text;
+}
+
+QString TesseractPool::joinTexts(const std::vector<QString> &texts)
+{
+    int length = 0;
+    for(const QString &text : texts) {
+        length += text.size();
+    }
+    QString joined;
+    joined.reserve(length);
+    for(const QString &text : texts) {
+        joined += text;
+    }
+    return joined;
+}
+
+void TesseractPool::sortReadingOrder(std::vector<cv::Rect> &areas)
+{
+    std::sort(areas.begin(), areas.end(), [](const cv::Rect &a, const cv::Rect &b) {
+        return a.y + a.height / 2 < b.y + b.height / 2;
+    });
+    // group areas whose vertical centers fall within the same line, then read
+    // every line from left to right
+    size_t line_start = 0;
+    while(line_start < areas.size()) {
+        const cv::Rect &first = areas[line_start];
+        int line_center = first.y + first.height / 2;
+        size_t line_end = line_start + 1;
+        while(line_end < areas.size()
+              && areas[line_end].y + areas[line_end].height / 2 - line_center < first.height / 2) {
+            line_end++;
+        }
+        std::sort(areas.begin() + line_start, areas.begin() + line_end,
+                  [](const cv::Rect &a, const cv::Rect &b) { return a.x < b.x; });
+        line_start = line_end;
+    }
+}
+
+tesseract::TessBaseAPI *TesseractPool::acquire()
+{
+    QMutexLocker locker(&idle_lock);
+    while(idle.isEmpty()) {
+        idle_changed.wait(&idle_lock);
+    }
+    return idle.takeLast();
+}
+
+void TesseractPool::release(tesseract::TessBaseAPI *api)
+{
+    QMutexLocker locker(&idle_lock);
+    idle.append(api);
+    idle_changed.wakeOne();
+}
+
+void TesseractPool::pinThread()
+{
+    // the threads only ever run tasks of this pool
+    static thread_local bool pinned = false;
+    if(!pinned) {
+        Utilities::pinCurrentThread(cpu_affinity);
+        pinned = true;
+    }
+}
@@ -0,0 +1,68 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef TESSERACT_POOL_H
+#define TESSERACT_POOL_H
+
+#include <vector>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QVector>
+#include <QString>
+
+#include "tesseract/baseapi.h"
+
+#include "opencv2/opencv.hpp"
+
+// Set of initialized Tesseract instances used to recognize the text areas of
+// a frame concurrently. A TessBaseAPI is not reentrant, so each area borrows
+// an instance for the time it takes to recognize it. Areas are recognized on
+// threads of the pool itself, not on the global QThreadPool, so pools of
+// different cameras do not compete for the same threads.
+class TesseractPool
+{
+public:
+    // size <= 0 creates one instance per core, or per core in cpus. The
+    // threads of the pool are pinned to cpus when it is not empty.
+    explicit TesseractPool(int size = 0, const QList<int> &cpus = QList<int>());
+    ~TesseractPool();
+
+    bool isReady() const {return !instances.isEmpty(); };
+    // Recognizes every area of image in parallel. areas is sorted in reading
+    // order first, and the texts are joined in that order.
+    QString recognizeAreas(const cv::Mat &image, std::vector<cv::Rect> &areas);
+    // Serial version for callers that already run one thread per core.
+    static QString recognizeAreas(tesseract::TessBaseAPI *api, const cv::Mat &image,
+                                  std::vector<cv::Rect> &areas);
+    // Recognizes every area in parallel, keeping the order of areas.
+    std::vector<QString> recognizeEach(const cv::Mat &image, const std::vector<cv::Rect> &areas);
+    static void sortReadingOrder(std::vector<cv::Rect> &areas);
+    static QString joinTexts(const std::vector<QString> &texts);
+    // Hands rect of image, BGR or gray, to api without copying gray images.
+    // Tesseract takes three channels for RGB, so color is converted to gray
+    // here, which it would do anyway.
+    static void setImage(tesseract::TessBaseAPI *api, const cv::Mat &image, const cv::Rect &rect);
+
+private:
+    static QString recognizeArea(tesseract::TessBaseAPI *api, const cv::Mat &image,
+                                 const cv::Rect &area);
+    tesseract::TessBaseAPI *acquire();
+    void release(tesseract::TessBaseAPI *api);
+    void pinThread();
+
+private:
+    QList<int> cpu_affinity;
+    QThreadPool threads;
+    QVector<tesseract::TessBaseAPI*> instances;
+    QVector<tesseract::TessBaseAPI*> idle;
+    QMutex idle_lock;
+    QWaitCondition idle_changed;
+};
+
+#endif // TESSERACT_POOL_H
@@ -0,0 +1,28 @@
+#   Copyright 2022 Javier Alvarez
+#   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+TEMPLATE = app
+TARGET = tst_event_dispatcher
+
+QT += core network testlib
+QT -= gui
+CONFIG += c++17 console testcase
+
+INCLUDEPATH += ../..
+
+# FrameRing::now() comes with the frame slots, which hold OpenCV images
+unix: !mac {
+    INCLUDEPATH += /usr/include/opencv4
+    LIBS += -L/usr/lib/x86_64-linux-gnu -lopencv_core
+}
+
+HEADERS += ../../event_dispatcher.h \
+    ../../frame_ring.h \
+    ../../utilities.h
+SOURCES += tst_event_dispatcher.cpp \
+    ../../event_dispatcher.cpp \
+    ../../frame_ring.cpp \
+    ../../utilities.cpp
@@ -0,0 +1,229 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QAtomicPointer>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QSettings>
+#include <QtTest>
+
+#include "event_dispatcher.h"
+
+// Keeps the payloads and only finishes a send when the test says so, so the
+// test decides how long an event is in flight and whether it fails.
+class FakeEventSink : public EventSink
+{
+    Q_OBJECT
+public:
+    FakeEventSink() { clock.start(); };
+    void send(const QByteArray &payload) override {
+        QMutexLocker locker(&lock);
+        payloads.append(QJsonDocument::fromJson(payload).object());
+        times.append(clock.elapsed());
+    };
+    QString name() const override { return "fake"; };
+
+    // From the test thread, delivered in the thread of the dispatcher.
+    void finish(bool ok) {
+        QMetaObject::invokeMethod(this, [this, ok]() { emit finished(ok); }, Qt::QueuedConnection);
+    };
+    int count() {
+        QMutexLocker locker(&lock);
+        return payloads.size();
+    };
+    QJsonObject payload(int index) {
+        QMutexLocker locker(&lock);
+        return payloads.value(index);
+    };
+    // ms from the creation of the sink to the send of a payload
+    qint64 time(int index) {
+        QMutexLocker locker(&lock);
+        return times.value(index);
+    };
+
+private:
+    QMutex lock;
+    QElapsedTimer clock;
+    QList<QJsonObject> payloads;
+    QList<qint64> times;
+};
+
+class EventDispatcherTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void mergesQueuedEvents();
+    void rateLimitsEachCamera();
+    void mergesIntoFailedEvent();
+    void givesUpAfterAttempts();
+    void dropsWhenFull();
+
+private:
+    // Read by the dispatchers created after it.
+    void setSettings(double min_interval, int attempts, int queue);
+    EventSink *makeSink();
+
+private:
+    // made in the thread of the dispatcher, deleted when it stops
+    QAtomicPointer<FakeEventSink> sink;
+};
+
+void EventDispatcherTest::initTestCase()
+{
+    // not the settings of the application
+    QCoreApplication::setOrganizationName("HardSoftKoop");
+    QCoreApplication::setApplicationName("HSK Vision tests");
+}
+
+void EventDispatcherTest::cleanupTestCase()
+{
+    QSettings().clear();
+}
+
+void EventDispatcherTest::init()
+{
+    sink.storeRelease(nullptr);
+}
+
+void EventDispatcherTest::setSettings(double min_interval, int attempts, int queue)
+{
+    QSettings settings;
+    settings.setValue("events/min_interval", min_interval);
+    settings.setValue("events/attempts", attempts);
+    settings.setValue("events/queue", queue);
+}
+
+EventSink *EventDispatcherTest::makeSink()
+{
+    FakeEventSink *made = new FakeEventSink();
+    sink.storeRelease(made);
+    return made;
+}
+
+void EventDispatcherTest::mergesQueuedEvents()
+{
+    setSettings(30, 5, 64);
+    EventDispatcher dispatcher([this]() { return makeSink(); });
+    QVERIFY(dispatcher.post("motion", 0, "zone 1"));
+    QVERIFY(dispatcher.post("motion", 0, "zone 2"));
+    QVERIFY(dispatcher.post("motion", 1));
+    QCOMPARE(dispatcher.mergedEvents(), (quint64)1);
+    dispatcher.start();
+    QTRY_VERIFY(sink.loadAcquire() != nullptr);
+    FakeEventSink *fake = sink.loadAcquire();
+
+    // one payload for both events of the first camera, the last detail wins
+    QTRY_COMPARE(fake->count(), 1);
+    QCOMPARE(fake->payload(0).value("camera").toInt(), 0);
+    QCOMPARE(fake->payload(0).value("count").toInt(), 2);
+    QCOMPARE(fake->payload(0).value("detail").toString(), QString("zone 2"));
+    fake->finish(true);
+    QTRY_COMPARE(fake->count(), 2);
+    QCOMPARE(fake->payload(1).value("camera").toInt(), 1);
+    QCOMPARE(fake->payload(1).value("count").toInt(), 1);
+    fake->finish(true);
+    QTRY_COMPARE(dispatcher.sentEvents(), (quint64)2);
+}
+
+void EventDispatcherTest::rateLimitsEachCamera()
+{
+    setSettings(0.5, 5, 64);
+    EventDispatcher dispatcher([this]() { return makeSink(); });
+    dispatcher.start();
+    QTRY_VERIFY(sink.loadAcquire() != nullptr);
+    FakeEventSink *fake = sink.loadAcquire();
+
+    dispatcher.post("motion", 0);
+    QTRY_COMPARE(fake->count(), 1);
+    fake->finish(true);
+    QTRY_COMPARE(dispatcher.sentEvents(), (quint64)1);
+
+    // the first camera waits for its interval, the other one does not
+    dispatcher.post("motion", 0);
+    dispatcher.post("motion", 1);
+    QTRY_COMPARE(fake->count(), 2);
+    QCOMPARE(fake->payload(1).value("camera").toInt(), 1);
+    fake->finish(true);
+    QTRY_COMPARE(fake->count(), 3);
+    QCOMPARE(fake->payload(2).value("camera").toInt(), 0);
+    QVERIFY(fake->time(2) - fake->time(0) >= 500);
+    fake->finish(true);
+    QTRY_COMPARE(dispatcher.sentEvents(), (quint64)3);
+}
+
+void EventDispatcherTest::mergesIntoFailedEvent()
+{
+    setSettings(30, 3, 64);
+    EventDispatcher dispatcher([this]() { return makeSink(); });
+    dispatcher.post("motion", 0, "first");
+    dispatcher.start();
+    QTRY_VERIFY(sink.loadAcquire() != nullptr);
+    FakeEventSink *fake = sink.loadAcquire();
+    QTRY_COMPARE(fake->count(), 1);
+
+    // the event in flight is not in the queue, a new one is queued on its own
+    dispatcher.post("motion", 0, "second");
+    QCOMPARE(dispatcher.mergedEvents(), (quint64)0);
+    fake->finish(false);
+
+    // the retry, after a backoff of one second, stands for both
+    QTRY_COMPARE(fake->count(), 2);
+    QVERIFY(fake->time(1) - fake->time(0) >= 1000);
+    QCOMPARE(fake->payload(1).value("count").toInt(), 2);
+    QCOMPARE(fake->payload(1).value("detail").toString(), QString("second"));
+    QCOMPARE(fake->payload(1).value("first").toString(), fake->payload(0).value("first").toString());
+    fake->finish(true);
+    QTRY_COMPARE(dispatcher.sentEvents(), (quint64)1);
+    QCOMPARE(fake->count(), 2);
+    QVERIFY(dispatcher.statistics().contains("retried 1"));
+}
+
+void EventDispatcherTest::givesUpAfterAttempts()
+{
+    setSettings(30, 2, 64);
+    EventDispatcher dispatcher([this]() { return makeSink(); });
+    dispatcher.post("motion", 0);
+    dispatcher.start();
+    QTRY_VERIFY(sink.loadAcquire() != nullptr);
+    FakeEventSink *fake = sink.loadAcquire();
+
+    QTRY_COMPARE(fake->count(), 1);
+    fake->finish(false);
+    QTRY_COMPARE(fake->count(), 2);
+    fake->finish(false);
+    QTRY_VERIFY(dispatcher.statistics().contains("failed 1"));
+    QCOMPARE(dispatcher.sentEvents(), (quint64)0);
+
+    // never sent, so not held back by the interval
+    dispatcher.post("motion", 0);
+    QTRY_COMPARE(fake->count(), 3);
+    fake->finish(true);
+    QTRY_COMPARE(dispatcher.sentEvents(), (quint64)1);
+}
+
+void EventDispatcherTest::dropsWhenFull()
+{
+    setSettings(30, 5, 2);
+    EventDispatcher dispatcher([this]() { return makeSink(); });
+    QVERIFY(dispatcher.post("motion", 0));
+    QVERIFY(dispatcher.post("motion", 1));
+    QVERIFY(!dispatcher.post("motion", 2));
+    // a repeated event still fits, it is merged
+    QVERIFY(dispatcher.post("motion", 1));
+    QCOMPARE(dispatcher.droppedEvents(), (quint64)1);
+    QCOMPARE(dispatcher.mergedEvents(), (quint64)1);
+}
+
+QTEST_GUILESS_MAIN(EventDispatcherTest)
+
+#include "tst_event_dispatcher.moc"
@@ -0,0 +1,467 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cmath>
+#include <QString>
+#include <QDebug>
+#include <QSettings>
+
+#include "text_detector.h"
+
+TextDetector::Config TextDetector::Config::fromSettings()
+{
+    QSettings settings;
+    Config config;
+    config.input_width = settings.value("detector/input_width", 320).toInt();
+    config.input_height = settings.value("detector/input_height", 320).toInt();
+    config.tiled = settings.value("detector/tiled", false).toBool();
+    config.tile_overlap = settings.value("detector/tile_overlap", 64).toInt();
+    return config;
+}
+
+void TextDetector::Config::save() const
+{
+    QSettings settings;
+    settings.setValue("detector/input_width", input_width);
+    settings.setValue("detector/input_height", input_height);
+    settings.setValue("detector/tiled", tiled);
+    settings.setValue("detector/tile_overlap", tile_overlap);
+}
+
+TextDetector::TextDetector():
+    conf_threshold(0.5), nms_threshold(0.4),
+    timings{0, 0, 0, 0}
+{
+    layer_names.push_back("feature_fusion/Conv_7/Sigmoid");
+    layer_names.push_back("feature_fusion/concat_3");
+    setConfig(Config::fromSettings());
+}
+
+void TextDetector::setConfig(const Config &new_config)
+{
+    config = new_config;
+    // EAST downsamples by 32, inputs must be multiples of it
+    config.input_width = std::max(32, (config.input_width + 16) / 32 * 32);
+    config.input_height = std::max(32, (config.input_height + 16) / 32 * 32);
+    config.tile_overlap = std::max(0, std::min(config.tile_overlap,
+        std::min(config.input_width, config.input_height) / 2));
+    input_size = cv::Size(config.input_width, config.input_height);
+}
+
+bool TextDetector::load(const std::string &model)
+{
+    try {
+        net = cv::dnn::readNet(model);
+    } catch (const cv::Exception &e) {
+        qDebug() << "EAST model could not be loaded:" << e.what();
+        net = cv::dnn::Net();
+        return false;
+    }
+    // warm up: the first forward pass allocates the layer buffers
+    cv::Mat blank = cv::Mat::zeros(input_size, CV_8UC3);
+    std::vector<cv::Rect> areas;
+    detect(blank, areas);
+    return true;
+}
+
+void TextDetector::detect(const cv::Mat &frame, std::vector<cv::Rect> &areas)
+{
+    // Load DNN network.
+    if (net.empty() && !load()) {
+        return;
+    }
+
+    int64 start = cv::getTickCount();
+    const cv::Mat *source = &frame;
+    if(frame.channels() == 1) {
+        cv::cvtColor(frame, color, cv::COLOR_GRAY2BGR);
+        source = &color;
+    }
+    // Tiles are cut at native resolution, so they are only worth it when the
+    // frame is larger than the network input; otherwise the frame is scaled.
+    bool tiled = config.tiled
+        && source->cols >= input_size.width && source->rows >= input_size.height
+        && (source->cols > input_size.width || source->rows > input_size.height);
+    tiles.clear();
+    if(tiled) {
+        computeTiles(source->size());
+    } else {
+        tiles.push_back(cv::Rect(0, 0, source->cols, source->rows));
+    }
+    prepareBlob(*source);
+    int64 prepared = cv::getTickCount();
+
+    net.setInput(blob);
+    net.forward(outs, layer_names);
+    int64 inferred = cv::getTickCount();
+
+    boxes.clear();
+    confidences.clear();
+    for(size_t t = 0; t < tiles.size(); t++) {
+        size_t first = boxes.size();
+        decode(batchItem(outs[0], t), batchItem(outs[1], t), conf_threshold, boxes, confidences);
+        if(tiled) {
+            cv::Point2f origin(tiles[t].x, tiles[t].y);
+            for(size_t i = first; i < boxes.size(); i++) {
+                boxes[i].center += origin;
+            }
+        }
+    }
+    int64 decoded = cv::getTickCount();
+
+    // a single NMS over all tiles merges the detections of the overlaps
+    indices.clear();
+    cv::dnn::NMSBoxes(boxes, confidences, conf_threshold, nms_threshold, indices);
+
+    cv::Point2f ratio(1.0f, 1.0f);
+    if(!tiled) {
+        ratio = cv::Point2f((float)frame.cols / input_size.width, (float)frame.rows / input_size.height);
+    }
+    cv::Rect bounds(0, 0, frame.cols, frame.rows);
+
+    for (size_t i = 0; i < indices.size(); ++i) {
+        cv::RotatedRect& box = boxes[indices[i]];
+        cv::Rect area = box.boundingRect();
+        area.x *= ratio.x;
+        area.width *= ratio.x;
+        area.y *= ratio.y;
+        area.height *= ratio.y;
+        area &= bounds;
+        if(!area.empty()) {
+            areas.push_back(area);
+        }
+    }
+    int64 done = cv::getTickCount();
+
+    double ms_per_tick = 1000.0 / cv::getTickFrequency();
+    timings.preprocess_ms = (prepared - start) * ms_per_tick;
+    timings.inference_ms = (inferred - prepared) * ms_per_tick;
+    timings.decode_ms = (decoded - inferred) * ms_per_tick;
+    timings.nms_ms = (done - decoded) * ms_per_tick;
+}
+
+void TextDetector::detect(const cv::Mat &frame, const std::vector<cv::Rect> &regions,
+                          std::vector<cv::Rect> &areas)
+{
+    if(regions.empty()) {
+        detect(frame, areas);
+        return;
+    }
+    Timings total = {0, 0, 0, 0};
+    for(const cv::Rect &region : regions) {
+        // the crop is a view into frame, nothing is copied
+        size_t first = areas.size();
+        detect(frame(region), areas);
+        for(size_t i = first; i < areas.size(); i++) {
+            areas[i] += region.tl();
+        }
+        total.preprocess_ms += timings.preprocess_ms;
+        total.inference_ms += timings.inference_ms;
+        total.decode_ms += timings.decode_ms;
+        total.nms_ms += timings.nms_ms;
+    }
+    timings = total;
+}
+
+std::vector<cv::Rect> TextDetector::clipRegions(const QList<QRect> &regions, const cv::Size &size)
+{
+    std::vector<cv::Rect> clipped;
+    cv::Rect bounds(0, 0, size.width, size.height);
+    for(const QRect &region : regions) {
+        cv::Rect rect = cv::Rect(region.x(), region.y(), region.width(), region.height()) & bounds;
+        if(!rect.empty()) {
+            clipped.push_back(rect);
+        }
+    }
+    return clipped;
+}
+
+void TextDetector::computeTiles(const cv::Size &frame_size)
+{
+    std::vector<int> xs, ys;
+    tileOrigins(frame_size.width, input_size.width, config.tile_overlap, xs);
+    tileOrigins(frame_size.height, input_size.height, config.tile_overlap, ys);
+    for(int y : ys) {
+        for(int x : xs) {
+            tiles.push_back(cv::Rect(x, y, input_size.width, input_size.height));
+        }
+    }
+}
+
+void TextDetector::tileOrigins(int length, int tile, int overlap, std::vector<int> &origins)
+{
+    // the last tile is aligned with the end of the frame
+    int step = std::max(32, tile - overlap);
+    for(int origin = 0; ; origin += step) {
+        if(origin + tile >= length) {
+            origins.push_back(std::max(0, length - tile));
+            break;
+        }
+        origins.push_back(origin);
+    }
+}
+
+cv::Mat TextDetector::batchItem(const cv::Mat &batch, size_t n)
+{
+    int size[] = {1, batch.size[1], batch.size[2], batch.size[3]};
+    return cv::Mat(4, size, CV_32F, (void *)batch.ptr<float>((int)n));
+}
+
+void TextDetector::prepareBlob(const cv::Mat &source)
+{
+    // Same result as cv::dnn::blobFromImages() on the tiles with scale 1.0,
+    // swapRB and no crop, but each tile is converted only once it has been
+    // downscaled and the planes are written straight into the preallocated
+    // blob.
+    const cv::Scalar mean(123.68, 116.78, 103.94);
+    const int count = (int)tiles.size();
+    if(blob.dims != 4 || blob.size[0] != count
+       || blob.size[2] != input_size.height || blob.size[3] != input_size.width) {
+        int size[] = {count, 3, input_size.height, input_size.width};
+        blob.create(4, size, CV_32F);
+        blob_planes.assign(count, std::vector<cv::Mat>(3));
+        for(int n = 0; n < count; n++) {
+            for(int c = 0; c < 3; c++) {
+                // plane c of the input frame feeds channel 2 - c of the blob
+                blob_planes[n][c] = cv::Mat(input_size, CV_32F, blob.ptr<float>(n, 2 - c));
+            }
+        }
+    }
+
+    for(int n = 0; n < count; n++) {
+        cv::Mat tile = source(tiles[n]);
+        if(tile.size() != input_size) {
+            cv::resize(tile, resized, input_size, 0, 0, cv::INTER_LINEAR);
+            tile = resized;
+        }
+        tile.convertTo(resized_float, CV_32F);
+        // channels are swapped when split below, so the mean is given reversed
+        cv::subtract(resized_float, cv::Scalar(mean[2], mean[1], mean[0]), resized_float);
+        cv::split(resized_float, blob_planes[n]);
+    }
+}
+
+void TextDetector::drawAreas(cv::Mat &frame, const std::vector<cv::Rect> &areas)
+{
+    // Render detections.
+    cv::Scalar green = cv::Scalar(0, 255, 0);
+    for (size_t i = 0; i < areas.size(); ++i) {
+        const cv::Rect &area = areas[i];
+        cv::rectangle(frame, area, green, 1);
+        QString index = QString("%1").arg(i);
+        cv::putText(
+            frame, index.toStdString(), cv::Point2f(area.x, area.y - 2),
+            cv::FONT_HERSHEY_SIMPLEX, 0.5, green, 1
+        );
+    }
+}
+
+void TextDetector::decode(const cv::Mat& scores, const cv::Mat& geometry, float scoreThresh,
+    std::vector<cv::RotatedRect>& detections, std::vector<float>& confidences)
+{
+    CV_Assert(scores.dims == 4); CV_Assert(geometry.dims == 4);
+    CV_Assert(scores.size[0] == 1); CV_Assert(scores.size[1] == 1);
+    CV_Assert(geometry.size[0] == 1);  CV_Assert(geometry.size[1] == 5);
+    CV_Assert(scores.size[2] == geometry.size[2]);
+    CV_Assert(scores.size[3] == geometry.size[3]);
+
+    // Rows are split in stripes decoded in parallel, each into its own
+    // buffers; the stripes are then appended in row order, so the output is
+    // in the same order as the scalar decoder's.
+    const int height = scores.size[2];
+    const int width = scores.size[3];
+    int stripes = std::max(1, std::min(cv::getNumThreads(), height / 8));
+    int rows_per_stripe = (height + stripes - 1) / stripes;
+    if((int)decode_stripes.size() < stripes) {
+        decode_stripes.resize(stripes);
+    }
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        for(int s = range.start; s < range.end; s++) {
+            DecodeStripe &stripe = decode_stripes[s];
+            stripe.boxes.clear();
+            stripe.scores.clear();
+            int last_row = std::min(height, (s + 1) * rows_per_stripe);
+            for(int y = s * rows_per_stripe; y < last_row; y++) {
+                decodeRow(scores, geometry, y, width, scoreThresh, stripe);
+            }
+        }
+    });
+
+    size_t total = detections.size();
+    for(int s = 0; s < stripes; s++) {
+        total += decode_stripes[s].boxes.size();
+    }
+    detections.reserve(total);
+    confidences.reserve(total);
+    for(int s = 0; s < stripes; s++) {
+        DecodeStripe &stripe = decode_stripes[s];
+        detections.insert(detections.end(), stripe.boxes.begin(), stripe.boxes.end());
+        confidences.insert(confidences.end(), stripe.scores.begin(), stripe.scores.end());
+    }
+}
+
+void TextDetector::decodeRow(const cv::Mat& scores, const cv::Mat& geometry, int y, int width,
+    float scoreThresh, DecodeStripe &stripe)
+{
+    const float* scoresData = scores.ptr<float>(0, 0, y);
+    const float* x0_data = geometry.ptr<float>(0, 0, y);
+    const float* x1_data = geometry.ptr<float>(0, 1, y);
+    const float* x2_data = geometry.ptr<float>(0, 2, y);
+    const float* x3_data = geometry.ptr<float>(0, 3, y);
+    const float* anglesData = geometry.ptr<float>(0, 4, y);
+
+    // threshold first, most cells of the score map are background
+    stripe.cells.clear();
+    for (int x = 0; x < width; ++x) {
+        if (scoresData[x] >= scoreThresh)
+            stripe.cells.push_back(x);
+    }
+    const int count = (int)stripe.cells.size();
+    if (count == 0)
+        return;
+
+    // batched trig over the surviving cells (SIMD in cv::polarToCart)
+    stripe.angles.resize(count);
+    stripe.cosines.resize(count);
+    stripe.sines.resize(count);
+    for (int i = 0; i < count; ++i)
+        stripe.angles[i] = anglesData[stripe.cells[i]];
+    cv::Mat angles(1, count, CV_32F, stripe.angles.data());
+    cv::Mat cosines(1, count, CV_32F, stripe.cosines.data());
+    cv::Mat sines(1, count, CV_32F, stripe.sines.data());
+    cv::polarToCart(cv::Mat(), angles, cosines, sines);
+
+    // Multiple by 4 because feature maps are 4 time less than input image.
+    const float offsetY = y * 4.0f;
+    for (int i = 0; i < count; ++i) {
+        const int x = stripe.cells[i];
+        const float cosA = stripe.cosines[i];
+        const float sinA = stripe.sines[i];
+        const float h = x0_data[x] + x2_data[x];
+        const float w = x1_data[x] + x3_data[x];
+
+        cv::Point2f offset(x * 4.0f + cosA * x1_data[x] + sinA * x2_data[x],
+            offsetY - sinA * x1_data[x] + cosA * x2_data[x]);
+        cv::Point2f p1 = cv::Point2f(-sinA * h, -cosA * h) + offset;
+        cv::Point2f p3 = cv::Point2f(-cosA * w, sinA * w) + offset;
+        stripe.boxes.push_back(cv::RotatedRect(0.5f * (p1 + p3), cv::Size2f(w, h),
+            -stripe.angles[i] * 180.0f / (float)CV_PI));
+        stripe.scores.push_back(scoresData[x]);
+    }
+}
+
+bool TextDetector::saveOutputs(const std::string &path) const
+{
+    if(outs.size() < 2) {
+        return false;
+    }
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    if(!fs.isOpened()) {
+        return false;
+    }
+    fs << "scores" << outs[0] << "geometry" << outs[1];
+    return true;
+}
+
+bool TextDetector::loadOutputs(const std::string &path, cv::Mat &scores, cv::Mat &geometry)
+{
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if(!fs.isOpened()) {
+        return false;
+    }
+    fs["scores"] >> scores;
+    fs["geometry"] >> geometry;
+    return !scores.empty() && !geometry.empty();
+}
+
+QString TextDetector::benchmarkDecode(const cv::Mat &scores, const cv::Mat &geometry, int iterations)
+{
+    std::vector<cv::RotatedRect> scalar_boxes, boxes;
+    std::vector<float> scalar_confidences, confidences;
+    double ms_per_tick = 1000.0 / cv::getTickFrequency();
+
+    int64 start = cv::getTickCount();
+    for(int i = 0; i < iterations; i++) {
+        decodeScalar(scores, geometry, conf_threshold, scalar_boxes, scalar_confidences);
+    }
+    double scalar_ms = (cv::getTickCount() - start) * ms_per_tick / iterations;
+
+    start = cv::getTickCount();
+    for(int i = 0; i < iterations; i++) {
+        boxes.clear();
+        confidences.clear();
+        decode(scores, geometry, conf_threshold, boxes, confidences);
+    }
+    double parallel_ms = (cv::getTickCount() - start) * ms_per_tick / iterations;
+
+    // both decoders emit boxes in the same order
+    float max_error = 0;
+    bool same_count = boxes.size() == scalar_boxes.size();
+    for(size_t i = 0; same_count && i < boxes.size(); i++) {
+        cv::Point2f d = boxes[i].center - scalar_boxes[i].center;
+        max_error = std::max(max_error, std::max(std::abs(d.x), std::abs(d.y)));
+    }
+
+    return QString("Score map %1x%2, %3 candidates, %4 iterations\n"
+                   "Scalar decode: %5 ms\n"
+                   "Parallel decode: %6 ms (%7 threads)\n"
+                   "Speedup: %8x\n"
+                   "Results: %9")
+        .arg(scores.size[3]).arg(scores.size[2]).arg(scalar_boxes.size()).arg(iterations)
+        .arg(scalar_ms, 0, 'f', 3)
+        .arg(parallel_ms, 0, 'f', 3).arg(cv::getNumThreads())
+        .arg(parallel_ms > 0 ? scalar_ms / parallel_ms : 0, 0, 'f', 2)
+        .arg(same_count ? QString("match, max center error %1 px").arg(max_error)
+                        : QString("differ (%1 vs %2 boxes)").arg(boxes.size()).arg(scalar_boxes.size()));
+}
+
+// Reference implementation, kept to validate and benchmark decode().
+void TextDetector::decodeScalar(const cv::Mat& scores, const cv::Mat& geometry, float scoreThresh,
+    std::vector<cv::RotatedRect>& detections, std::vector<float>& confidences)
+{
+    CV_Assert(scores.dims == 4); CV_Assert(geometry.dims == 4);
+    CV_Assert(scores.size[0] == 1); CV_Assert(scores.size[1] == 1);
+    CV_Assert(geometry.size[0] == 1);  CV_Assert(geometry.size[1] == 5);
+    CV_Assert(scores.size[2] == geometry.size[2]);
+    CV_Assert(scores.size[3] == geometry.size[3]);
+
+    detections.clear();
+    confidences.clear();
+    const int height = scores.size[2];
+    const int width = scores.size[3];
+    for (int y = 0; y < height; ++y) {
+        const float* scoresData = scores.ptr<float>(0, 0, y);
+        const float* x0_data = geometry.ptr<float>(0, 0, y);
+        const float* x1_data = geometry.ptr<float>(0, 1, y);
+        const float* x2_data = geometry.ptr<float>(0, 2, y);
+        const float* x3_data = geometry.ptr<float>(0, 3, y);
+        const float* anglesData = geometry.ptr<float>(0, 4, y);
+        for (int x = 0; x < width; ++x) {
+            float score = scoresData[x];
+            if (score < scoreThresh)
+                continue;
+
+            // Decode a prediction.
+            // Multiple by 4 because feature maps are 4 time less than input image.
+            float offsetX = x * 4.0f, offsetY = y * 4.0f;
+            float angle = anglesData[x];
+            float cosA = std::cos(angle);
+            float sinA = std::sin(angle);
+            float h = x0_data[x] + x2_data[x];
+            float w = x1_data[x] + x3_data[x];
+
+            cv::Point2f offset(offsetX + cosA * x1_data[x] + sinA * x2_data[x],
+                offsetY - sinA * x1_data[x] + cosA * x2_data[x]);
+            cv::Point2f p1 = cv::Point2f(-sinA * h, -cosA * h) + offset;
+            cv::Point2f p3 = cv::Point2f(-cosA * w, sinA * w) + offset;
+            cv::RotatedRect r(0.5f * (p1 + p3), cv::Size2f(w, h), -angle * 180.0f / (float)CV_PI);
+            detections.push_back(r);
+            confidences.push_back(score);
+        }
+    }
+}
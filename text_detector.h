@@ -0,0 +1,120 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef TEXT_DETECTOR_H
+#define TEXT_DETECTOR_H
+
+#include <string>
+#include <vector>
+#include <QString>
+#include <QList>
+#include <QRect>
+
+#include "opencv2/opencv.hpp"
+#include "opencv2/dnn.hpp"
+
+// EAST text area detector. cv::dnn::Net is not safe to run concurrently, so
+// every thread that detects text owns its own TextDetector. The network input
+// blob and the intermediate buffers are kept between calls, so detecting on
+// frames of a constant size does not allocate.
+class TextDetector
+{
+public:
+    struct Timings {
+        double preprocess_ms;
+        double inference_ms;
+        double decode_ms;
+        double nms_ms;
+    };
+
+    // Network input size, rounded to multiples of 32. In tiled mode a frame
+    // larger than the input is cut into overlapping tiles of that size at
+    // native resolution, run as one batch, instead of being scaled down.
+    struct Config {
+        int input_width;
+        int input_height;
+        bool tiled;
+        int tile_overlap;
+
+        static Config fromSettings();
+        void save() const;
+    };
+
+    TextDetector();
+    const Config &currentConfig() const {return config; };
+    void setConfig(const Config &config);
+    // Loads the network and runs it once on a blank frame, so the first real
+    // frame does not pay for the lazy initialization of the backend.
+    bool load(const std::string &model = "./frozen_east_text_detection.pb");
+    bool isLoaded() const {return !net.empty(); };
+    // Finds the text areas of frame, in frame coordinates. Loads the network
+    // on first use if load() was not called before.
+    void detect(const cv::Mat &frame, std::vector<cv::Rect> &areas);
+    // Same, but only looks inside the given regions of frame. The areas are
+    // still returned in frame coordinates.
+    void detect(const cv::Mat &frame, const std::vector<cv::Rect> &regions,
+                std::vector<cv::Rect> &areas);
+    // Regions of interest clipped to a frame of the given size. Empty when
+    // none of them overlaps the frame, meaning the whole frame is used.
+    static std::vector<cv::Rect> clipRegions(const QList<QRect> &regions, const cv::Size &size);
+    const Timings &lastTimings() const {return timings; };
+    static void drawAreas(cv::Mat &frame, const std::vector<cv::Rect> &areas);
+
+    // Network outputs of the last detection, to record tensors for
+    // benchmarkDecode().
+    bool saveOutputs(const std::string &path) const;
+    static bool loadOutputs(const std::string &path, cv::Mat &scores, cv::Mat &geometry);
+    // Times decode() against the original scalar loop and checks that both
+    // produce the same boxes. Returns a printable report.
+    QString benchmarkDecode(const cv::Mat &scores, const cv::Mat &geometry, int iterations = 100);
+
+private:
+    struct DecodeStripe {
+        std::vector<int> cells;
+        std::vector<float> angles;
+        std::vector<float> cosines;
+        std::vector<float> sines;
+        std::vector<cv::RotatedRect> boxes;
+        std::vector<float> scores;
+    };
+
+    void computeTiles(const cv::Size &frame_size);
+    static void tileOrigins(int length, int tile, int overlap, std::vector<int> &origins);
+    static cv::Mat batchItem(const cv::Mat &batch, size_t n);
+    void prepareBlob(const cv::Mat &source);
+    void decode(const cv::Mat& scores, const cv::Mat& geometry, float scoreThresh,
+        std::vector<cv::RotatedRect>& detections, std::vector<float>& confidences);
+    static void decodeRow(const cv::Mat& scores, const cv::Mat& geometry, int y, int width,
+        float scoreThresh, DecodeStripe &stripe);
+    static void decodeScalar(const cv::Mat& scores, const cv::Mat& geometry, float scoreThresh,
+        std::vector<cv::RotatedRect>& detections, std::vector<float>& confidences);
+
+private:
+    cv::dnn::Net net;
+    Config config;
+    cv::Size input_size;
+    float conf_threshold;
+    float nms_threshold;
+    std::vector<std::string> layer_names;
+
+    // reused between frames
+    cv::Mat color;
+    cv::Mat resized;
+    cv::Mat resized_float;
+    cv::Mat blob;
+    std::vector<std::vector<cv::Mat> > blob_planes;
+    std::vector<cv::Rect> tiles;
+    std::vector<cv::Mat> outs;
+    std::vector<cv::RotatedRect> boxes;
+    std::vector<float> confidences;
+    std::vector<int> indices;
+    std::vector<DecodeStripe> decode_stripes;
+
+    Timings timings;
+};
+
+#endif // TEXT_DETECTOR_H
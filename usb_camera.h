@@ -6,77 +6,26 @@
     You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
 */
 // mode: c++
-#ifndef CAPTURE_THREAD_H
-#define CAPTURE_THREAD_H
+#ifndef USB_CAMERA_H
+#define USB_CAMERA_H
 
-#include <QString>
-#include <QThread>
-#include <QMutex>
+#include "frame_source.h"
 
-#include "opencv2/opencv.hpp"
-#include "opencv2/videoio.hpp"
-#include "opencv2/video/background_segm.hpp"
-
-using namespace std;
-
-class USBCaptureThread : public QThread
+// V4L2 / USB camera opened through OpenCV.
+class UsbFrameSource : public FrameSource
 {
-    Q_OBJECT
 public:
-    USBCaptureThread(int camera, QMutex *lock);
-    USBCaptureThread(QString videoPath, QMutex *lock);
-    ~USBCaptureThread();
-    void setRunning(bool run) {running = run; };
-    void startCalcFPS() {fps_calculating = true; };
-    enum VideoSavingStatus {
-                            STARTING,
-                            STARTED,
-                            STOPPING,
-                            STOPPED
-    };
-
-    void setVideoSavingStatus(VideoSavingStatus status) {video_saving_status = status; };
-    void setMotionDetectingStatus(bool status) {
-        motion_detecting_status = status;
-        motion_detected = false;
-        if(video_saving_status != STOPPED) video_saving_status = STOPPING;
-    };
-
-protected:
-    void run() override;
-
-signals:
-    void frameCaptured(cv::Mat *data);
-    void fpsChanged(float fps);
-    void videoSaved(QString name);
+    explicit UsbFrameSource(int camera);
+    QString name() const override;
+    bool open() override;
+    bool read(cv::Mat &frame) override;
+    bool skip() override;
+    void close() override;
+    double fps() const override;
 
 private:
-    void calculateFPS(cv::VideoCapture &cap);
-    void startSavingVideo(cv::Mat &firstFrame);
-    void stopSavingVideo();
-    void motionDetect(cv::Mat &frame);
-
-private:
-    bool running;
     int cameraID;
-    QString videoPath;
-    QMutex *data_lock;
-    cv::Mat frame;
-
-    // FPS calculating
-    bool fps_calculating;
-    float fps;
-
-    // video saving
-    int frame_width, frame_height;
-    VideoSavingStatus video_saving_status;
-    QString saved_video_name;
-    cv::VideoWriter *video_writer;
-
-    // motion analysis
-    bool motion_detecting_status;
-    bool motion_detected;
-    cv::Ptr<cv::BackgroundSubtractorMOG2> segmentor;
+    cv::VideoCapture cap;
 };
 
-#endif // CAPTURE_THREAD_H
+#endif // USB_CAMERA_H
@@ -5,19 +5,15 @@
 
     You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
 */
-#include <QObject>
-#include <QApplication>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <QDateTime>
 #include <QDir>
 #include <QStandardPaths>
-#include <QNetworkAccessManager>
-#include <QNetworkRequest>
-#include <QNetworkReply>
-#include <QUrl>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QHostInfo>
 #include <QDebug>
+#include <QSettings>
+#include <QVariant>
 
 #include "utilities.h"
 
@@ -40,23 +36,47 @@ QString Utilities::getSavedVideoPath(QString name, QString postfix)
     return QString("%1/%2.%3").arg(Utilities::getDataPath(), name, postfix);
 }
 
-void Utilities::notifyMobile(int cameraID)
+QList<QRect> Utilities::loadRegionsOfInterest(int camera)
 {
-    QString endpoint = "https://maker.ifttt.com/trigger/...";
-    // CHANGE endpoint TO YOURS HERE:
-    // https://maker.ifttt.com/trigger/Motion-Detected-by-Gazer/with/key/-YOUR_KEY
-    // QString endpoint = QUrl("https://maker.ifttt.com/YOUR_END PIOIN");
-    QNetworkRequest request = QNetworkRequest(QUrl(endpoint));
-    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QJsonObject json;
-    json.insert("value1", QString("%1").arg(cameraID));
-    json.insert("value2", QHostInfo::localHostName());
-    QNetworkAccessManager nam;
-    QNetworkReply *rep = nam.post(request, QJsonDocument(json).toJson());
-    while(!rep->isFinished()) {
-        QApplication::processEvents();
+    QSettings settings;
+    QString key = QString("roi/camera%1/regions").arg(camera);
+    // the first camera keeps the regions saved before they were per camera
+    if(camera == 0 && !settings.contains(key)) {
+        key = "roi/regions";
     }
-    // QString strReply = (QString)rep->readAll();
-    // qDebug()<<"Test: "<<strReply;
-    rep->deleteLater();
+    QList<QRect> regions;
+    for(const QVariant &region : settings.value(key).toList()) {
+        regions.append(region.toRect());
+    }
+    return regions;
+}
+
+void Utilities::saveRegionsOfInterest(const QList<QRect> &regions, int camera)
+{
+    QSettings settings;
+    QVariantList list;
+    for(const QRect &region : regions) {
+        list.append(region);
+    }
+    settings.setValue(QString("roi/camera%1/regions").arg(camera), list);
+}
+
+bool Utilities::pinCurrentThread(const QList<int> &cpus)
+{
+    if(cpus.isEmpty()) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(error != 0) {
+        qDebug() << "Cannot pin thread to cores" << cpus << strerror(error);
+        return false;
+    }
+    return true;
 }
@@ -9,6 +9,8 @@
 #define UTILITIES_H_
 
 #include <QString>
+#include <QList>
+#include <QRect>
 
 class Utilities
 {
@@ -16,7 +18,11 @@ class Utilities
     static QString getDataPath();
     static QString newSavedVideoName();
     static QString getSavedVideoPath(QString name, QString postfix);
-    static void notifyMobile(int cameraID);
+    // Regions of interest of each camera, by its index in the preview.
+    static QList<QRect> loadRegionsOfInterest(int camera = 0);
+    static void saveRegionsOfInterest(const QList<QRect> &regions, int camera = 0);
+    // Restricts the calling thread to the given cores, no-op when empty.
+    static bool pinCurrentThread(const QList<int> &cpus);
 };
 
 #endif
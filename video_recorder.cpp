@@ -0,0 +1,274 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QFile>
+#include <QSettings>
+#include <QtConcurrent>
+#include <QDebug>
+
+#include "utilities.h"
+#include "video_recorder.h"
+
+VideoRecorder::VideoRecorder(int capacity, DropPolicy policy, int pre_roll_ms, int segment_ms, QObject *parent):
+    QThread(parent), queue_capacity(qMax(1, capacity)), policy(policy),
+    pre_roll((qint64)qMax(0, pre_roll_ms) * 1000),
+    segment_duration((qint64)qMax(1000, segment_ms) * 1000),
+    queued_frames(0), finishing(false),
+    written(0), dropped(0), max_depth(0), encode_time(0), metrics(nullptr),
+    segment_number(0), cover_pending(false), event_start(false),
+    segment(new SegmentWriter()), pending(new SegmentWriter())
+{
+    jpeg_params = {cv::IMWRITE_JPEG_QUALITY, QSettings().value("recording/jpeg_quality", 90).toInt()};
+    pending_path = Utilities::getSavedVideoPath(
+        QString(".pending-%1").arg((quintptr)this, 0, 16), "000");
+    closer.setMaxThreadCount(1);
+}
+
+VideoRecorder::~VideoRecorder()
+{
+    finish();
+    wait();
+    closeRecording();
+    closer.waitForDone();
+    pending->discard();
+    delete pending;
+    delete segment;
+}
+
+QString VideoRecorder::segmentPath(const QString &name, int segment)
+{
+    return Utilities::getSavedVideoPath(name, QString("%1").arg(segment, 3, 10, QChar('0')));
+}
+
+void VideoRecorder::startRecording(QString name)
+{
+    push(Item{Item::START, FrameRef(), 0, name});
+}
+
+void VideoRecorder::stopRecording()
+{
+    push(Item{Item::STOP, FrameRef(), 0, QString()});
+}
+
+void VideoRecorder::push(Item item)
+{
+    QMutexLocker locker(&queue_lock);
+    items.push_back(std::move(item));
+    queue_changed.wakeOne();
+}
+
+bool VideoRecorder::addFrame(const FrameRef &frame, quint32 flags)
+{
+    QMutexLocker locker(&queue_lock);
+    if(queued_frames >= queue_capacity) {
+        dropped++;
+        if(metrics != nullptr) {
+            metrics->countRecordingDrop();
+        }
+        if(policy == DROP_NEWEST) {
+            return false;
+        }
+        for(auto it = items.begin(); it != items.end(); ++it) {
+            if(it->type == Item::FRAME) {
+                items.erase(it);
+                queued_frames--;
+                break;
+            }
+        }
+    }
+    items.push_back(Item{Item::FRAME, frame, flags, QString()});
+    queued_frames++;
+    max_depth = qMax(max_depth, queued_frames);
+    queue_changed.wakeOne();
+    return true;
+}
+
+void VideoRecorder::finish()
+{
+    QMutexLocker locker(&queue_lock);
+    finishing = true;
+    queue_changed.wakeOne();
+}
+
+bool VideoRecorder::takeItem(Item &item)
+{
+    QMutexLocker locker(&queue_lock);
+    while(items.empty()) {
+        if(finishing) {
+            return false;
+        }
+        queue_changed.wait(&queue_lock);
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    if(item.type == Item::FRAME) {
+        queued_frames--;
+    }
+    return true;
+}
+
+void VideoRecorder::run()
+{
+    Item item;
+    while(takeItem(item)) {
+        switch(item.type) {
+        case Item::START:
+            closeRecording();
+            file_name = item.name;
+            segment_number = 0;
+            cover_pending = true;
+            event_start = true;
+            flushPreRoll();
+            break;
+        case Item::FRAME:
+            if(!file_name.isEmpty()) {
+                encode(item.frame, item.flags, encoded);
+                if(event_start) {
+                    encoded.flags |= RecordingIndexEntry::EVENT_START;
+                    event_start = false;
+                }
+                writeFrame(encoded);
+            } else if(pre_roll > 0) {
+                bufferFrame(item.frame, item.flags);
+            }
+            break;
+        case Item::STOP:
+            closeRecording();
+            break;
+        }
+        // give the slot back to the ring right away
+        item.frame = FrameRef();
+    }
+    closeRecording();
+}
+
+void VideoRecorder::encode(const FrameRef &frame, quint32 flags, EncodedFrame &encoded)
+{
+    qint64 start = FrameRing::now();
+    // ring frames are BGR or gray, as the encoder takes them
+    const cv::Mat &image = frame.image();
+    cv::imencode(".jpg", image, encoded.jpeg, jpeg_params);
+    encoded.size = image.size();
+    encoded.channels = image.channels();
+    encoded.flags = flags;
+    encoded.sequence = frame.sequence();
+    encoded.timestamp = frame.timestamp();
+    qint64 duration = FrameRing::now() - start;
+    if(metrics != nullptr) {
+        metrics->record(PipelineMetrics::ENCODING, duration);
+    }
+    QMutexLocker locker(&queue_lock);
+    encode_time += duration;
+}
+
+void VideoRecorder::bufferFrame(const FrameRef &frame, quint32 flags)
+{
+    // open the next segment now, not on the frame that starts the recording
+    if(!pending->isOpen()) {
+        preparePending(frame.image().size(), frame.image().channels());
+    }
+
+    // recycle the buffer of the oldest frame when it has expired
+    EncodedFrame buffered;
+    while(!pre_roll_frames.empty() && frame.timestamp() - pre_roll_frames.front().timestamp > pre_roll) {
+        buffered.jpeg.swap(pre_roll_frames.front().jpeg);
+        pre_roll_frames.pop_front();
+    }
+    encode(frame, flags | RecordingIndexEntry::PRE_ROLL, buffered);
+    pre_roll_frames.push_back(std::move(buffered));
+}
+
+void VideoRecorder::flushPreRoll()
+{
+    // already compressed, written as they are
+    for(const EncodedFrame &frame : pre_roll_frames) {
+        writeFrame(frame);
+    }
+    pre_roll_frames.clear();
+}
+
+void VideoRecorder::writeFrame(const EncodedFrame &frame)
+{
+    // the cover shows what started the recording, not the oldest pre-roll
+    if(cover_pending && (frame.flags & RecordingIndexEntry::EVENT_START)) {
+        QFile cover(Utilities::getSavedVideoPath(file_name, "jpg"));
+        if(cover.open(QIODevice::WriteOnly)) {
+            cover.write((const char *)frame.jpeg.data(), frame.jpeg.size());
+        }
+        cover_pending = false;
+    }
+    if(segment->isOpen() && (frame.timestamp - segment->firstTimestamp() >= segment_duration
+                             || frame.size != segment->frameSize())) {
+        closeSegment(QString());
+        segment_number++;
+    }
+    if(!segment->isOpen() && !openSegment(frame.size, frame.channels)) {
+        return;
+    }
+    if(segment->write(frame.jpeg, frame.flags, frame.sequence, frame.timestamp)) {
+        QMutexLocker locker(&queue_lock);
+        written++;
+    } else if(!segment->isOpen()) {
+        // it could not be repaired and ends here, go on with the next one
+        segment_number++;
+    }
+}
+
+bool VideoRecorder::openSegment(cv::Size size, int channels)
+{
+    QString path = segmentPath(file_name, segment_number);
+    if(pending->isOpen() && pending->frameSize() == size && pending->frameChannels() == channels
+       && pending->rename(path, segment_number)) {
+        std::swap(segment, pending);
+        // ready for the next segment
+        preparePending(size, channels);
+        return true;
+    }
+    return segment->open(path, segment_number, size, channels);
+}
+
+void VideoRecorder::preparePending(cv::Size size, int channels)
+{
+    pending->discard();
+    pending->open(pending_path, 0, size, channels);
+}
+
+void VideoRecorder::closeRecording()
+{
+    if(file_name.isEmpty()) {
+        return;
+    }
+    QString name = file_name;
+    file_name.clear();
+    if(!segment->isOpen()) {
+        // no frame arrived, nothing was written
+        return;
+    }
+    closeSegment(name);
+}
+
+void VideoRecorder::closeSegment(const QString &saved_name)
+{
+    // the finished segment is complete on disk once closed
+    SegmentWriter *finished = segment;
+    segment = new SegmentWriter();
+    QtConcurrent::run(&closer, [this, finished, saved_name]() {
+        finished->close();
+        delete finished;
+        if(!saved_name.isEmpty()) {
+            emit videoSaved(saved_name);
+        }
+    });
+}
+
+QString VideoRecorder::statistics() const
+{
+    QMutexLocker locker(&queue_lock);
+    return QString("recorded %1, dropped %2, queue max %3/%4, %5 ms per frame")
+        .arg(written).arg(dropped).arg(max_depth).arg(queue_capacity)
+        .arg(written ? encode_time / 1000.0 / written : 0.0, 0, 'f', 1);
+}
@@ -0,0 +1,144 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef VIDEO_RECORDER_H
+#define VIDEO_RECORDER_H
+
+#include <deque>
+#include <vector>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include "opencv2/opencv.hpp"
+
+#include "frame_ring.h"
+#include "pipeline_metrics.h"
+#include "recording.h"
+
+// Encodes recordings on its own thread, so the cost of JPEG encoding and
+// disk latency never reaches the capture thread. The capture thread queues
+// references to ring frames, up to a fixed number; when the encoder falls
+// behind the drop policy decides which frame is lost, and the loss is
+// counted.
+//
+// Recordings are written as segments of segment_ms with a frame index, see
+// recording.h, so each closed segment is usable even if the process dies
+// later. Finished segments are synced and closed on another thread, so the
+// encoder does not wait for the disk at every rollover. Frames queued while
+// no recording is open are kept JPEG compressed for the last pre_roll_ms,
+// and written at the start of the next recording so it shows what led to the
+// event. The first segment of the next recording is opened ahead of time on
+// a pending file, renamed when the recording starts.
+class VideoRecorder : public QThread
+{
+    Q_OBJECT
+public:
+    enum DropPolicy {
+                     DROP_NEWEST,   // refuse the incoming frame
+                     DROP_OLDEST    // forget the oldest queued frame
+    };
+
+    explicit VideoRecorder(int capacity = 16, DropPolicy policy = DROP_NEWEST,
+                           int pre_roll_ms = 0, int segment_ms = 60000, QObject *parent = nullptr);
+    // Finishes the queued frames and the current recording.
+    ~VideoRecorder();
+
+    // Called from the capture thread. name is given to Utilities::getSavedVideoPath().
+    void startRecording(QString name);
+    // flags are RecordingIndexEntry::Flags
+    bool addFrame(const FrameRef &frame, quint32 flags = 0);
+    void stopRecording();
+    // Ends the thread once the queue is written.
+    void finish();
+    // Also counts encoding times and drops there. Set before start().
+    void setMetrics(PipelineMetrics *metrics) {this->metrics = metrics; };
+
+    int capacity() const { return queue_capacity; };
+    bool preRollEnabled() const { return pre_roll > 0; };
+    quint64 writtenFrames() const { return written; };
+    quint64 droppedFrames() const { return dropped; };
+    int maxQueueDepth() const { return max_depth; };
+    QString statistics() const;
+
+    // Path of a segment without its extensions, see SegmentWriter.
+    static QString segmentPath(const QString &name, int segment);
+
+protected:
+    void run() override;
+
+signals:
+    // Emitted when the last segment of a recording is closed.
+    void videoSaved(QString name);
+
+private:
+    struct Item {
+        enum Type {
+                   START,
+                   FRAME,
+                   STOP
+        } type;
+        FrameRef frame;
+        quint32 flags;
+        QString name;
+    };
+
+    struct EncodedFrame {
+        std::vector<uchar> jpeg;
+        cv::Size size;
+        int channels;
+        quint32 flags;
+        quint64 sequence;
+        qint64 timestamp;
+    };
+
+    void push(Item item);
+    bool takeItem(Item &item);
+    void encode(const FrameRef &frame, quint32 flags, EncodedFrame &encoded);
+    void bufferFrame(const FrameRef &frame, quint32 flags);
+    void flushPreRoll();
+    void writeFrame(const EncodedFrame &frame);
+    bool openSegment(cv::Size size, int channels);
+    void preparePending(cv::Size size, int channels);
+    void closeRecording();
+    void closeSegment(const QString &saved_name);
+
+private:
+    int queue_capacity;
+    DropPolicy policy;
+    qint64 pre_roll;        // microseconds
+    qint64 segment_duration;
+    mutable QMutex queue_lock;
+    QWaitCondition queue_changed;
+    std::deque<Item> items;
+    int queued_frames;
+    bool finishing;
+
+    // statistics, written with queue_lock held
+    quint64 written;
+    quint64 dropped;
+    int max_depth;
+    qint64 encode_time;     // microseconds, total
+    PipelineMetrics *metrics;
+
+    // only used by the recorder thread
+    QString file_name;
+    int segment_number;
+    bool cover_pending;
+    bool event_start;
+    SegmentWriter *segment;
+    SegmentWriter *pending;
+    QString pending_path;
+    std::vector<int> jpeg_params;
+    EncodedFrame encoded;
+    std::deque<EncodedFrame> pre_roll_frames;
+    QThreadPool closer;     // one thread, segments are closed in order
+};
+
+#endif // VIDEO_RECORDER_H
@@ -0,0 +1,277 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <QPainter>
+#include <QVarLengthArray>
+#include <QtMath>
+
+#include "video_widget.h"
+
+static const char *vertex_shader =
+    "attribute highp vec2 position;\n"
+    "attribute highp vec2 coordinate;\n"
+    "varying highp vec2 texture_coordinate;\n"
+    "void main() {\n"
+    "    texture_coordinate = coordinate;\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+// frames are uploaded as they are, the color order is fixed here
+static const char *fragment_shader =
+    "uniform sampler2D frame;\n"
+    "uniform bool bgr;\n"
+    "varying highp vec2 texture_coordinate;\n"
+    "void main() {\n"
+    "    lowp vec4 color = texture2D(frame, texture_coordinate);\n"
+    "    gl_FragColor = bgr ? vec4(color.b, color.g, color.r, 1.0) : vec4(color.rgb, 1.0);\n"
+    "}\n";
+
+VideoWidget::VideoWidget(QWidget *parent):
+    QOpenGLWidget(parent), initialized(false)
+{
+}
+
+VideoWidget::~VideoWidget()
+{
+    clear();
+}
+
+void VideoWidget::setTileCount(int count)
+{
+    if(count < tiles.size()) {
+        deleteTextures();
+        tiles.clear();
+    }
+    while(tiles.size() < count) {
+        tiles.append(Tile{FrameRef(), FrameRef(), 0, 0, 0, 0, QList<QRect>(), QVector<QRect>(),
+                          QVector<QRect>(), QVector<bool>(), QVector<QRect>(), nullptr});
+    }
+    update();
+}
+
+void VideoWidget::setFrame(int index, const FrameRef &frame)
+{
+    if(index < 0 || index >= tiles.size()) {
+        return;
+    }
+    // the previous pending frame, if not painted yet, is released here
+    tiles[index].pending = frame;
+    update();
+}
+
+void VideoWidget::clear()
+{
+    deleteTextures();
+    tiles.clear();
+    update();
+}
+
+void VideoWidget::deleteTextures()
+{
+    if(!initialized) {
+        return;
+    }
+    makeCurrent();
+    for(Tile &tile : tiles) {
+        if(tile.texture != 0) {
+            glDeleteTextures(1, &tile.texture);
+            tile.texture = 0;
+        }
+    }
+    doneCurrent();
+}
+
+void VideoWidget::setRegions(int index, const QList<QRect> &regions)
+{
+    if(index < 0 || index >= tiles.size()) {
+        return;
+    }
+    tiles[index].regions = regions;
+    update();
+}
+
+void VideoWidget::setAreas(int index, const QVector<QRect> &areas)
+{
+    if(index < 0 || index >= tiles.size()) {
+        return;
+    }
+    tiles[index].areas = areas;
+    update();
+}
+
+void VideoWidget::setMotion(int index, const QVector<QRect> &zones, const QVector<bool> &active,
+                            const QVector<QRect> &boxes)
+{
+    if(index < 0 || index >= tiles.size()) {
+        return;
+    }
+    Tile &tile = tiles[index];
+    tile.zones = zones;
+    tile.active_zones = active;
+    tile.boxes = boxes;
+    update();
+}
+
+QImage VideoWidget::snapshot(int index) const
+{
+    if(index < 0 || index >= tiles.size()) {
+        return QImage();
+    }
+    const FrameRef &frame = tiles[index].pending.isNull() ? tiles[index].shown : tiles[index].pending;
+    if(frame.isNull()) {
+        return QImage();
+    }
+    const cv::Mat &mat = frame.image();
+    if(mat.channels() == 1) {
+        return QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_Grayscale8).copy();
+    }
+    return QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_RGB888).rgbSwapped();
+}
+
+void VideoWidget::setMetrics(int index, PipelineMetrics *metrics)
+{
+    if(index < 0 || index >= tiles.size()) {
+        return;
+    }
+    tiles[index].metrics = metrics;
+}
+
+void VideoWidget::initializeGL()
+{
+    initializeOpenGLFunctions();
+    program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_shader);
+    program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragment_shader);
+    program.bindAttributeLocation("position", 0);
+    program.bindAttributeLocation("coordinate", 1);
+    program.link();
+    initialized = true;
+}
+
+QRectF VideoWidget::tileRect(int index) const
+{
+    const Tile &tile = tiles[index];
+    int columns = qCeil(qSqrt(tiles.size()));
+    int rows = (tiles.size() + columns - 1) / columns;
+    const qreal gap = 4;
+    QRectF cell((index % columns) * (qreal)width() / columns, (index / columns) * (qreal)height() / rows,
+                (qreal)width() / columns - gap, (qreal)height() / rows - gap);
+    if(tile.width == 0 || tile.height == 0) {
+        return cell;
+    }
+    qreal scale = qMin(cell.width() / tile.width, cell.height() / tile.height);
+    QSizeF size(tile.width * scale, tile.height * scale);
+    return QRectF(cell.center() - QPointF(size.width() / 2, size.height() / 2), size);
+}
+
+void VideoWidget::upload(Tile &tile)
+{
+    cv::Mat image = tile.pending.image();
+    if(!image.isContinuous()) {
+        // GL ES has no row length to upload with
+        image = image.clone();
+    }
+    GLenum format = image.channels() == 1 ? GL_LUMINANCE : GL_RGB;
+    if(tile.texture == 0) {
+        glGenTextures(1, &tile.texture);
+        glBindTexture(GL_TEXTURE_2D, tile.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, tile.texture);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if(image.cols != tile.width || image.rows != tile.height || image.channels() != tile.channels) {
+        // storage is only allocated when the frame format changes
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.cols, image.rows, 0, format, GL_UNSIGNED_BYTE, image.data);
+        tile.width = image.cols;
+        tile.height = image.rows;
+        tile.channels = image.channels();
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.cols, image.rows, format, GL_UNSIGNED_BYTE, image.data);
+    }
+    // the slot goes back to the ring once the next frame is uploaded
+    tile.shown = std::move(tile.pending);
+}
+
+void VideoWidget::paintGL()
+{
+    QPainter painter(this);
+    painter.beginNativePainting();
+    glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    program.bind();
+    program.setUniformValue("frame", 0);
+    glActiveTexture(GL_TEXTURE0);
+    static const GLfloat coordinates[] = {0, 0, 1, 0, 0, 1, 1, 1};
+    // tiles with a new frame in this pass
+    QVarLengthArray<int, 16> uploaded;
+    for(int i = 0; i < tiles.size(); i++) {
+        Tile &tile = tiles[i];
+        if(!tile.pending.isNull()) {
+            upload(tile);
+            uploaded.append(i);
+        }
+        if(tile.texture == 0) {
+            continue;
+        }
+        glBindTexture(GL_TEXTURE_2D, tile.texture);
+        program.setUniformValue("bgr", (GLint)(tile.channels == 3));
+        QRectF rect = tileRect(i);
+        GLfloat left = 2 * rect.left() / width() - 1, right = 2 * rect.right() / width() - 1;
+        GLfloat top = 1 - 2 * rect.top() / height(), bottom = 1 - 2 * rect.bottom() / height();
+        GLfloat positions[] = {left, top, right, top, left, bottom, right, bottom};
+        program.enableAttributeArray(0);
+        program.enableAttributeArray(1);
+        program.setAttributeArray(0, GL_FLOAT, positions, 2);
+        program.setAttributeArray(1, GL_FLOAT, coordinates, 2);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    program.disableAttributeArray(0);
+    program.disableAttributeArray(1);
+    program.release();
+    painter.endNativePainting();
+    qint64 painted = FrameRing::now();
+    for(int i : uploaded) {
+        if(tiles[i].metrics != nullptr) {
+            tiles[i].metrics->record(PipelineMetrics::DISPLAY, painted - tiles[i].shown.timestamp());
+        }
+    }
+
+    // overlays, in frame coordinates scaled to each tile
+    for(int i = 0; i < tiles.size(); i++) {
+        const Tile &tile = tiles[i];
+        if(tile.width == 0) {
+            continue;
+        }
+        QRectF rect = tileRect(i);
+        painter.save();
+        painter.translate(rect.topLeft());
+        painter.scale(rect.width() / tile.width, rect.height() / tile.height);
+        painter.setBrush(Qt::NoBrush);
+        painter.setPen(QPen(Qt::blue, 0));
+        for(const QRect &region : tile.regions) {
+            painter.drawRect(region);
+        }
+        painter.setPen(QPen(Qt::green, 0));
+        for(const QRect &area : tile.areas) {
+            painter.drawRect(area);
+        }
+        for(int j = 0; j < tile.zones.size(); j++) {
+            QPen pen(Qt::yellow, j < tile.active_zones.size() && tile.active_zones[j] ? 3 : 1);
+            pen.setCosmetic(true);
+            painter.setPen(pen);
+            painter.drawRect(tile.zones[j]);
+        }
+        painter.setPen(QPen(Qt::red, 0));
+        for(const QRect &box : tile.boxes) {
+            painter.drawRect(box);
+        }
+        painter.restore();
+    }
+}
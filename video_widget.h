@@ -0,0 +1,87 @@
+/*  Copyright 2022 Javier Alvarez
+    This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef VIDEO_WIDGET_H
+#define VIDEO_WIDGET_H
+
+#include <QImage>
+#include <QList>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLWidget>
+#include <QRect>
+#include <QVector>
+
+#include "frame_ring.h"
+#include "pipeline_metrics.h"
+
+// Live view of one or more cameras, side by side on a square grid. Every
+// tile keeps one texture, and a new frame is uploaded into it in place, BGR
+// or gray straight from the ring: the shader swaps red and blue, so there is
+// no color conversion on the CPU and no QImage or QPixmap copy. setFrame()
+// only keeps a reference to the frame; frames set faster than the screen
+// refreshes replace each other and only the last one is uploaded.
+class VideoWidget : public QOpenGLWidget, protected QOpenGLFunctions
+{
+    Q_OBJECT
+public:
+    explicit VideoWidget(QWidget *parent = nullptr);
+    ~VideoWidget();
+
+    void setTileCount(int count);
+    int tileCount() const {return tiles.size(); };
+    void setFrame(int index, const FrameRef &frame);
+    // Drops every frame and tile, before the rings they come from go away.
+    void clear();
+
+    // Overlays of one tile, in frame coordinates: the regions of interest,
+    // in blue, and the text areas, in green.
+    void setRegions(int index, const QList<QRect> &regions);
+    void setAreas(int index, const QVector<QRect> &areas);
+    // The motion zones, in yellow and thicker while active, and the boxes
+    // around the moving areas, in red.
+    void setMotion(int index, const QVector<QRect> &zones, const QVector<bool> &active,
+                   const QVector<QRect> &boxes);
+
+    // RGB copy of the frame shown in a tile, for the still image tools.
+    QImage snapshot(int index = 0) const;
+    // Where the time from capture to paint of a tile is counted, see
+    // PipelineMetrics::DISPLAY. Not owned.
+    void setMetrics(int index, PipelineMetrics *metrics);
+
+protected:
+    void initializeGL() override;
+    void paintGL() override;
+
+private:
+    struct Tile {
+        FrameRef pending;   // not uploaded yet
+        FrameRef shown;
+        GLuint texture;
+        int width;
+        int height;
+        int channels;
+        QList<QRect> regions;
+        QVector<QRect> areas;
+        QVector<QRect> zones;
+        QVector<bool> active_zones;
+        QVector<QRect> boxes;
+        PipelineMetrics *metrics;
+    };
+
+    // Where the frame of a tile is drawn, keeping its aspect ratio.
+    QRectF tileRect(int index) const;
+    void upload(Tile &tile);
+    void deleteTextures();
+
+private:
+    QVector<Tile> tiles;
+    QOpenGLShaderProgram program;
+    bool initialized;
+};
+
+#endif // VIDEO_WIDGET_H